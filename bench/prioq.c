@@ -0,0 +1,193 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * Quality and throughput of relaxed priority queues.
+ *
+ * Usage: prioq [threads [ops]]
+ *
+ * Quality is the rank error of each element returned: how many
+ * smaller elements were still queued.  Ranks are counted with a
+ * Fenwick tree over the priority range.  Throughput is add+get pairs
+ * per second against a queue of 10k elements, for 1 up to the given
+ * number of threads, doubling.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <tcprioq.h>
+
+#define RANGE (1 << 20)
+#define QUEUED 100000
+#define PAIRS 1000000
+#define MAXTHREADS 256
+
+static int fenwick[RANGE + 1];
+
+static void
+fw_add(long i, int d)
+{
+    for(i++; i <= RANGE; i += i & -i)
+	fenwick[i] += d;
+}
+
+/* Number of elements less than i. */
+static long
+fw_count(long i)
+{
+    long s = 0;
+
+    for(; i > 0; i -= i & -i)
+	s += fenwick[i];
+
+    return s;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+    intptr_t x = (intptr_t) a, y = (intptr_t) b;
+
+    return x < y? -1: x > y;
+}
+
+static void
+add(tcprioq_t *q, uint32_t flags, long x)
+{
+    if(flags & TCPRIOQ_PRIO)
+	tcprioq_addp(q, NULL, x);
+    else
+	tcprioq_add(q, (void *) x);
+    fw_add(x, 1);
+}
+
+static void
+quality(const char *name, uint32_t flags)
+{
+    tcprioq_t *q = tcprioq_newf(16, 0, cmp, flags);
+    unsigned seed = 1;
+    long i, r, max = 0;
+    double sum = 0;
+    uint64_t p;
+    void *d;
+
+    memset(fenwick, 0, sizeof(fenwick));
+    for(i = 0; i < QUEUED; i++)
+	add(q, flags, rand_r(&seed) % RANGE);
+
+    for(i = 0; i < PAIRS; i++){
+	add(q, flags, rand_r(&seed) % RANGE);
+	tcprioq_getp(q, &d, &p);
+	if(!(flags & TCPRIOQ_PRIO))
+	    p = (intptr_t) d;
+	r = fw_count(p);
+	fw_add(p, -1);
+	sum += r;
+	if(r > max)
+	    max = r;
+    }
+
+    printf("%-16s rank error mean %.2f max %ld\n", name, sum / PAIRS, max);
+    tcprioq_free(q);
+}
+
+static tcprioq_t *queue;
+static long ops;
+
+static void *
+worker(void *arg)
+{
+    unsigned seed = (uintptr_t) arg;
+    uint64_t p;
+    void *d;
+    long i;
+
+    for(i = 0; i < ops; i++){
+	tcprioq_addp(queue, NULL, rand_r(&seed) % RANGE);
+	tcprioq_getp(queue, &d, &p);
+    }
+
+    return NULL;
+}
+
+static void
+throughput(const char *name, uint32_t flags, int threads)
+{
+    pthread_t th[MAXTHREADS];
+    double t;
+    int i;
+
+    queue = tcprioq_newf(1024, 1, NULL, flags);
+    for(i = 0; i < 10000; i++)
+	tcprioq_addp(queue, NULL, i * 100);
+
+    t = now();
+    for(i = 0; i < threads; i++)
+	pthread_create(&th[i], NULL, worker, (void *) (uintptr_t) (i + 1));
+    for(i = 0; i < threads; i++)
+	pthread_join(th[i], NULL);
+    t = now() - t;
+
+    printf("%-8s %3d threads: %6.2f Mops/s\n", name, threads,
+	   2.0 * threads * ops / t / 1e6);
+    tcprioq_free(queue);
+}
+
+extern int
+main(int argc, char **argv)
+{
+    int threads = argc > 1? atoi(argv[1]): 8;
+    int t;
+
+    ops = argc > 2? atol(argv[2]): 1000000;
+    if(threads < 1 || threads > MAXTHREADS){
+	fprintf(stderr, "threads must be 1 to %d\n", MAXTHREADS);
+	return 1;
+    }
+
+    quality("strict", TCPRIOQ_PRIO);
+    quality("relaxed", TCPRIOQ_PRIO | TCPRIOQ_RELAXED);
+    quality("relaxed arity 4", TCPRIOQ_PRIO | TCPRIOQ_RELAXED | TCPRIOQ_ARITY4);
+    quality("relaxed compare", TCPRIOQ_RELAXED);
+
+    for(t = 1; t <= threads; t *= 2)
+	throughput("locked", TCPRIOQ_PRIO, t);
+    for(t = 1; t <= threads; t *= 2)
+	throughput("relaxed", TCPRIOQ_PRIO | TCPRIOQ_RELAXED, t);
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * Throughput of the concurrent skip list against the locked
+ * red-black tree.
+ *
+ * Usage: skiplist [threads [ops]]
+ *
+ * The tree starts with every other key of 1..KEYS.  Each operation
+ * picks a random key: 78% are finds, 10% inserts, 10% deletes and 2%
+ * range scans of up to 200 keys.  The ops are shared between 1 up to
+ * the given number of threads, doubling.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <tctree.h>
+
+#define KEYS 100000
+#define SCAN 200
+#define MAXTHREADS 256
+
+static tctree_t *tree;
+static long ops;
+static int threads;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+    intptr_t x = (intptr_t) a, y = (intptr_t) b;
+
+    return x < y? -1: x > y;
+}
+
+static void *
+worker(void *arg)
+{
+    unsigned seed = (uintptr_t) arg * 7919 + 1;
+    tctree_cursor_t *c;
+    intptr_t k;
+    void *r;
+    long i;
+    int op;
+
+    for(i = 0; i < ops / threads; i++){
+	k = rand_r(&seed) % KEYS + 1;
+	op = rand_r(&seed) % 100;
+	if(op < 10){
+	    tctree_search(tree, (void *) k, &r);
+	} else if(op < 20){
+	    tctree_delete(tree, (void *) k, &r);
+	} else if(op < 22){
+	    c = tctree_range(tree, (void *) k, (void *) (k + SCAN), 0);
+	    while(!tctree_next(c, &r))
+		;
+	    tctree_cursor_free(c);
+	} else {
+	    tctree_find(tree, (void *) k, &r);
+	}
+    }
+
+    return NULL;
+}
+
+static void
+run(const char *name, int locking, uint32_t flags)
+{
+    pthread_t th[MAXTHREADS];
+    intptr_t k;
+    double t;
+    int i;
+
+    tree = tctree_new(locking, cmp, flags);
+    for(k = 1; k <= KEYS; k += 2)
+	tctree_search(tree, (void *) k, NULL);
+
+    t = now();
+    for(i = 0; i < threads; i++)
+	pthread_create(&th[i], NULL, worker, (void *) (uintptr_t) i);
+    for(i = 0; i < threads; i++)
+	pthread_join(th[i], NULL);
+    t = now() - t;
+
+    printf("%-10s %3d threads: %6.2f Mops/s\n", name, threads,
+	   ops / t / 1e6);
+    tctree_destroy(tree, NULL);
+}
+
+extern int
+main(int argc, char **argv)
+{
+    int max = argc > 1? atoi(argv[1]): 64;
+
+    ops = argc > 2? atol(argv[2]): 2000000;
+    if(max < 1 || max > MAXTHREADS){
+	fprintf(stderr, "threads must be 1 to %d\n", MAXTHREADS);
+	return 1;
+    }
+
+    for(threads = 1; threads <= max; threads *= 2)
+	run("locked", 1, 0);
+    for(threads = 1; threads <= max; threads *= 2)
+	run("concurrent", 0, TCTREE_CONCURRENT);
+
+    return 0;
+}
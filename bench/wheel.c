@@ -0,0 +1,152 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * Timer churn in the timer wheel against a handle priority queue.
+ *
+ * Usage: wheel [timers [ticks]]
+ *
+ * Models connection timeouts: each tick, RESCHED random timers are
+ * pushed back by their timeout plus some jitter, as on activity, and
+ * the expired ones are collected and re-armed.  This is run with idle
+ * timeouts far beyond the run and with short ones that keep firing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <tcwheel.h>
+#include <tcprioq.h>
+
+#define RESCHED 5000
+#define JITTER 1000
+#define BATCH 64
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+run_wheel(uint64_t *h, long timers, long ticks, uint64_t timeout,
+	  long *fired)
+{
+    tcwheel_t *w = tcwheel_new(0, 0);
+    unsigned seed = 1;
+    void *b[BATCH];
+    double t = now();
+    uint64_t tick;
+    long i, k;
+    int n;
+
+    for(i = 0; i < timers; i++)
+	tcwheel_add(w, (void *) i, timeout + rand_r(&seed) % JITTER, &h[i]);
+
+    for(tick = 1; tick < ticks; tick++){
+	for(k = 0; k < RESCHED; k++){
+	    i = rand_r(&seed) % timers;
+	    if(tcwheel_update(w, h[i], tick + timeout + rand_r(&seed) % JITTER))
+		tcwheel_add(w, (void *) i, tick + timeout, &h[i]);
+	}
+	while((n = tcwheel_get_many(w, tick, b, BATCH)) > 0)
+	    *fired += n;
+    }
+
+    t = now() - t;
+    tcwheel_free(w);
+
+    return t;
+}
+
+static double
+run_prioq(uint64_t *h, long timers, long ticks, uint64_t timeout,
+	  long *fired)
+{
+    tcprioq_t *q = tcprioq_newf(timers, 0, NULL, TCPRIOQ_HANDLES |
+				TCPRIOQ_PRIO | TCPRIOQ_ARITY4);
+    unsigned seed = 1;
+    double t = now();
+    uint64_t tick, p;
+    long i, k;
+    void *d;
+
+    for(i = 0; i < timers; i++)
+	tcprioq_addh(q, (void *) i, timeout + rand_r(&seed) % JITTER, &h[i]);
+
+    for(tick = 1; tick < ticks; tick++){
+	for(k = 0; k < RESCHED; k++){
+	    i = rand_r(&seed) % timers;
+	    if(tcprioq_update(q, h[i], tick + timeout + rand_r(&seed) % JITTER))
+		tcprioq_addh(q, (void *) i, tick + timeout, &h[i]);
+	}
+	while(!tcprioq_peekp(q, &d, &p) && p <= tick){
+	    tcprioq_getp(q, &d, &p);
+	    (*fired)++;
+	}
+    }
+
+    t = now() - t;
+    tcprioq_free(q);
+
+    return t;
+}
+
+static void
+run(const char *name, uint64_t *h, long timers, long ticks,
+    uint64_t timeout)
+{
+    long wf = 0, qf = 0;
+    double wt, qt;
+
+    wt = run_wheel(h, timers, ticks, timeout, &wf);
+    qt = run_prioq(h, timers, ticks, timeout, &qf);
+    printf("%-6s timeouts: wheel %.2fs, prioq %.2fs, %ld fired\n",
+	   name, wt, qt, wf);
+    if(wf != qf)
+	printf("fired counts differ: wheel %ld, prioq %ld\n", wf, qf);
+}
+
+extern int
+main(int argc, char **argv)
+{
+    long timers = argc > 1? atol(argv[1]): 200000;
+    long ticks = argc > 2? atol(argv[2]): 4000;
+    uint64_t *h;
+
+    if(timers < 1 || !(h = malloc(timers * sizeof(*h)))){
+	fprintf(stderr, "bad timer count\n");
+	return 1;
+    }
+
+    run("idle", h, timers, ticks, 30000);
+    run("short", h, timers, ticks, 50);
+    free(h);
+
+    return 0;
+}
@@ -39,19 +39,51 @@ typedef struct tcattr {
     void *value;
 } tcattr_t;
 
+typedef struct tcweak tcweak_t;
+
+/* Flags for tcallocf(). */
+#define TCALLOC_ZERO    0x1	/* Clear the memory */
+#define TCALLOC_LOCAL   0x2	/* Non-atomic reference count */
+#define TCALLOC_COMPACT 0x4	/* Count only, no functions or attributes */
+
 extern void *tcalloc(size_t);
+extern void *tcallocf(size_t size, tc_ref_fn r, tcfree_fn f,
+		      uint32_t flags);
 extern void *tcallocd(size_t, tc_ref_fn, tcfree_fn);
 extern void *tcallocz(size_t);
 extern void *tcallocdz(size_t, tc_ref_fn, tcfree_fn);
 extern void *tcref(void *);
 extern void tcfree(void *);
 
+/* Modes for tcfree_defer(). */
+#define TCFREE_NOW        0	/* Free blocks at once */
+#define TCFREE_DRAIN      1	/* Queue them until tcfree_drain */
+#define TCFREE_BACKGROUND 2	/* Queue them for a reclaimer thread */
+
+/* Set how blocks are freed when their count drops to zero.  Returns the
+ * previous mode, or -1 on error. */
+extern int tcfree_defer(int mode);
+
+/* Free queued blocks.  Returns the number freed. */
+extern unsigned long tcfree_drain(void);
+
 extern int tcattr_set(void *p, char *name, void *val,
 		      tcattr_ref_t r, tcfree_fn f);
 extern void *tcattr_get(void *p, char *name);
 extern int tcattr_getall(void *ptr, int n, tcattr_t *attr);
 extern int tcattr_del(void *p, char *name);
 
+/* Return the shared copy of an attribute name.  Passing it instead of
+ * the string skips hashing the name. */
+extern char *tcattr_intern(char *name);
+
+/* Weak reference to p, freed with tcfree.  Returns NULL on error. */
+extern tcweak_t *tcweak_new(void *p);
+
+/* Take a reference, like tcref, to the block referred to by w.
+ * Returns NULL if the block has been freed. */
+extern void *tcweak_get(tcweak_t *w);
+
 #ifdef __cplusplus
 }
 #endif
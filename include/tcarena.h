@@ -0,0 +1,53 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+#ifndef _TCARENA_H
+#define _TCARENA_H
+
+#include <tctypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tcarena tcarena_t;
+
+/* Create an arena getting memory in blocks of block bytes.  Free with
+ * tcfree. */
+extern tcarena_t *tcarena_new(size_t block, int lock);
+extern void *tcarena_alloc(tcarena_t *a, size_t size);
+extern void *tcarena_memalign(tcarena_t *a, size_t align, size_t size);
+
+/* Release everything allocated from the arena at once. */
+extern void tcarena_reset(tcarena_t *a);
+
+/* Take memory for containers created by the calling thread from a,
+ * or from the heap if a is NULL.  Returns the previous arena. */
+extern tcarena_t *tcarena_use(tcarena_t *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+/**
+    Copyright (C) 2003  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+#ifndef _TCMEM_H
+#define _TCMEM_H
+
+#include <tctypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void *tcmem_alloc(size_t size);
+extern void *tcmem_zalloc(size_t size);
+extern void *tcmem_realloc(void *p, size_t size);
+extern void tcmem_free(void *p);
+extern char *tcmem_strdup(const char *s);
+
+/* Make libtc use tcmem for its own allocations. */
+extern void tcmem_use(int on);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,16 +25,56 @@
 #ifndef _TCMEMPOOL_H
 #define _TCMEMPOOL_H
 
+#include <stdio.h>
+#include <tctypes.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct tcmempool tcmempool_t;
 
+/* Flags for tcmempool_newf(). */
+#define TCMEMPOOL_MAGAZINES 0x1 /* Per-thread caches of free chunks */
+#define TCMEMPOOL_HUGEPAGES 0x2 /* Back 2 MiB slabs with huge pages */
+#define TCMEMPOOL_DEBUG     0x4 /* Poison free chunks, check frees */
+#define TCMEMPOOL_SLAB(shift) ((shift) << 8) /* Slabs of 1 << shift bytes */
+#define TCMEMPOOL_SLABMASK  0x1f00
+
 extern tcmempool_t *tcmempool_new(size_t size, int lock);
+extern tcmempool_t *tcmempool_newf(size_t size, int lock, uint32_t flags);
+extern void tcmempool_retain(tcmempool_t *mp, int slabs);
 extern void *tcmempool_get(tcmempool_t *mp);
 extern void tcmempool_free(void *p);
 
+/* Size of the chunk p, or 0 if p is not from any pool. */
+extern size_t tcmempool_chunksize(const void *p);
+
+typedef struct tcmempool_stats {
+    size_t size;		/* Chunk size */
+    size_t slab;		/* Slab size in bytes */
+    unsigned long slabs;	/* Slabs mapped */
+    unsigned long pages;	/* System pages in those slabs */
+    unsigned long capacity;	/* Chunks the slabs hold */
+    unsigned long inuse;	/* Chunks in use */
+    unsigned long cached;	/* Free chunks in thread magazines */
+    unsigned long peak;		/* Highest inuse + cached */
+    unsigned long maps, unmaps;	/* Slabs mapped and unmapped so far */
+    unsigned long lockwaits;	/* Times the pool lock was contended */
+} tcmempool_stats_t;
+
+extern void tcmempool_stats(tcmempool_t *mp, tcmempool_stats_t *st);
+
+/* Call fn for each live chunk, with the caller that got it if the pool
+ * has TCMEMPOOL_DEBUG.  Returns the number of live chunks.  The pool is
+ * locked meanwhile. */
+typedef void (*tcmempool_walk_fn)(void *chunk, void *caller, void *data);
+extern unsigned long tcmempool_walk(tcmempool_t *mp, tcmempool_walk_fn fn,
+				    void *data);
+
+/* Print statistics and live chunks. */
+extern void tcmempool_dump(tcmempool_t *mp, FILE *f);
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,10 +33,48 @@ extern "C" {
 #endif
 
 typedef struct tcprioq tcprioq_t;
+typedef uint64_t tcprioq_handle_t;
+
+/* Flags for tcprioq_newf(). */
+#define TCPRIOQ_ARITY4 0x1 /* 4 children per node */
+#define TCPRIOQ_ARITY8 0x2 /* 8 children per node */
+#define TCPRIOQ_PRIO   0x4 /* Numeric priorities, use tcprioq_addp */
+#define TCPRIOQ_HANDLES 0x8 /* Allow update and remove, use tcprioq_addh */
+#define TCPRIOQ_RELAXED 0x10 /* Scalable, nearly in order, always locks */
 
 extern tcprioq_t *tcprioq_new(int size, int lock, tccompare_fn cmp);
+extern tcprioq_t *tcprioq_newf(int size, int lock, tccompare_fn cmp,
+			       uint32_t flags);
 extern int tcprioq_add(tcprioq_t *pq, void *data);
+extern int tcprioq_addp(tcprioq_t *pq, void *data, uint64_t prio);
 extern int tcprioq_get(tcprioq_t *pq, void **ret);
+extern int tcprioq_getp(tcprioq_t *pq, void **ret, uint64_t *prio);
+
+/* Add n elements at once, in linear time.  prio is required with
+ * TCPRIOQ_PRIO, and NULL otherwise.  If h is non-NULL, the handles
+ * are stored there. */
+extern int tcprioq_build(tcprioq_t *pq, void **data, uint64_t *prio,
+			 tcprioq_handle_t *h, int n);
+
+/* Remove up to n of the smallest elements, in order.  Returns the
+ * number removed. */
+extern int tcprioq_get_many(tcprioq_t *pq, void **ret, uint64_t *prio,
+			    int n);
+
+/* Add an element, storing a handle for it in *h.  prio is only used
+ * with TCPRIOQ_PRIO.  Handles become invalid when the element leaves
+ * the queue. */
+extern int tcprioq_addh(tcprioq_t *pq, void *data, uint64_t prio,
+			tcprioq_handle_t *h);
+
+/* Move an element after its priority changed.  Return 0 on success,
+ * 1 if the handle is not valid. */
+extern int tcprioq_update(tcprioq_t *pq, tcprioq_handle_t h, uint64_t prio);
+extern int tcprioq_remove(tcprioq_t *pq, tcprioq_handle_t h, void **ret);
+
+/* Return the smallest element without removing it.  Does not lock. */
+extern int tcprioq_peek(tcprioq_t *pq, void **ret);
+extern int tcprioq_peekp(tcprioq_t *pq, void **ret, uint64_t *prio);
 extern int tcprioq_items(tcprioq_t *pq);
 extern void tcprioq_free(tcprioq_t *pq);
 
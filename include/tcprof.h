@@ -0,0 +1,81 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+#ifndef _TCPROF_H
+#define _TCPROF_H
+
+#include <stdio.h>
+#include <tctypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The parts of libtc allocations are reported from. */
+#define TCPROF_OTHER   0
+#define TCPROF_ALLOC   1	/* tcalloc blocks */
+#define TCPROF_MEM     2	/* tcmem_alloc */
+#define TCPROF_MEMPOOL 3	/* tcmempool chunks and pools */
+#define TCPROF_ARENA   4	/* Arena blocks */
+#define TCPROF_LIST    5
+#define TCPROF_HASH    6
+#define TCPROF_TREE    7	/* tctree, whichever TCTREE_ engine */
+#define TCPROF_CONF    8
+#define TCPROF_SUBSYSTEMS 9
+
+/* Allocation observer.  alloc is called after each allocation, with
+ * the subsystem and the name of the libtc function making it as tag,
+ * and free before the memory is released.  Either may be NULL. */
+typedef struct tcprof_observer {
+    void (*alloc)(void *p, size_t size, int subsys, const char *tag,
+		  void *data);
+    void (*free)(void *p, void *data);
+    void *data;
+} tcprof_observer_t;
+
+/* Add or remove an observer.  Returns 0, or -1 if there are too many
+ * observers or o was not added.  Other threads may still be inside
+ * o->alloc or o->free when tcprof_unobserve returns, so o->data must
+ * not be freed until they are known to be done. */
+extern int tcprof_observe(tcprof_observer_t *o);
+extern int tcprof_unobserve(tcprof_observer_t *o);
+
+extern const char *tcprof_subsystem(int subsys);
+
+/* Sampling heap profiler.  Records the stack of about one in rate
+ * allocations, until stopped. */
+extern int tcprof_heap_start(unsigned long rate);
+extern int tcprof_heap_stop(void);
+
+/* Write the live sampled allocations as a pprof heap profile. */
+extern int tcprof_heap_dump(FILE *f);
+
+/* Estimated bytes in use by subsys, from the samples. */
+extern size_t tcprof_heap_inuse(int subsys);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
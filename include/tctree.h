@@ -33,6 +33,24 @@ extern "C" {
 #endif
 
 typedef struct tctree tctree_t;
+typedef struct tctree_cursor tctree_cursor_t;
+typedef int (*tctree_next_fn)(void *data, void *ret);
+
+/* Flags for tctree_new(). */
+#define TCTREE_BTREE    0x100 /* Use B+-tree instead of red-black tree */
+#define TCTREE_RANK     0x200 /* Keep subtree sizes for rank and select */
+#define TCTREE_CONCURRENT 0x400 /* Lock-free lookups, fine-grained writes */
+#define TCTREE_PERSISTENT 0x800 /* Copy-on-write nodes, allows snapshots */
+#define TCTREE_INTKEY   0x1000 /* Keys are intptr_t values, cmp unused */
+#define TCTREE_U64KEY   0x2000 /* Keys point to uint64_t, cmp unused */
+#define TCTREE_STRKEY   0x4000 /* Keys are strings ordered by strcmp */
+
+/* Flags for tctree_range(). */
+#define TCTREE_REVERSE  0x01  /* Return keys in descending order */
+#define TCTREE_NOLOW    0x02  /* No lower limit */
+#define TCTREE_NOHIGH   0x04  /* No upper limit */
+#define TCTREE_EXCLLOW  0x08  /* Exclude key equal to lower limit */
+#define TCTREE_EXCLHIGH 0x10  /* Exclude key equal to upper limit */
 
 extern tctree_t *tctree_new(int locking, tccompare_fn cmp, uint32_t flags);
 extern int tctree_find(tctree_t *t, void *key, void *ret);
@@ -41,6 +59,44 @@ extern int tctree_replace(tctree_t *t, void *key, void *ret);
 extern int tctree_delete(tctree_t *t, void *key, void *ret);
 extern int tctree_destroy(tctree_t *t, tcfree_fn f);
 
+/* Add keys, which must be sorted, rebuilding the tree in linear time.
+ * Keys already in the tree are kept.  Returns the number of keys added,
+ * or -1 if keys are not sorted. */
+extern long tctree_build_sorted(tctree_t *t, void **keys, unsigned long n);
+
+/* Same as above, reading keys by calling next until it returns nonzero. */
+extern long tctree_build_sorted_iter(tctree_t *t, tctree_next_fn next,
+				     void *data);
+
+/* Returns key count. */
+extern unsigned long tctree_items(tctree_t *t);
+
+/* Find the k-th smallest key, or count the keys less than key.  Return 0
+ * if found, 1 if not, -1 if the tree was not created with TCTREE_RANK. */
+extern int tctree_select(tctree_t *t, unsigned long k, void *ret);
+extern int tctree_rank(tctree_t *t, void *key, unsigned long *rank);
+
+/* Return a read-only copy of a TCTREE_PERSISTENT tree, sharing its
+ * nodes.  Free with tctree_destroy. */
+extern tctree_t *tctree_snapshot(tctree_t *t);
+
+/* Set the size in bytes of B+-tree nodes.  The tree must be empty. */
+extern int tctree_setnodesize(tctree_t *t, size_t size);
+
+/* Find the smallest key >= key (lower_bound) or > key (upper_bound).
+ * Return 0 if found, 1 otherwise. */
+extern int tctree_lower_bound(tctree_t *t, void *key, void *ret);
+extern int tctree_upper_bound(tctree_t *t, void *key, void *ret);
+
+/* Create a cursor over the keys between low and high. */
+extern tctree_cursor_t *tctree_range(tctree_t *t, void *low, void *high,
+				     uint32_t flags);
+
+/* Store the next key from cursor in *ret.  Return 0 on success, 1 when
+ * there are no more keys in the range. */
+extern int tctree_next(tctree_cursor_t *c, void *ret);
+extern void tctree_cursor_free(tctree_cursor_t *c);
+
 #ifdef __cplusplus
 }
 #endif
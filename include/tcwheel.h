@@ -0,0 +1,51 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+#ifndef _TCWHEEL_H
+#define _TCWHEEL_H
+
+#include <tctypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tcwheel tcwheel_t;
+typedef uint64_t tcwheel_handle_t;
+
+extern tcwheel_t *tcwheel_new(int lock, uint64_t now);
+extern int tcwheel_add(tcwheel_t *w, void *data, uint64_t expires,
+		       tcwheel_handle_t *h);
+extern int tcwheel_update(tcwheel_t *w, tcwheel_handle_t h, uint64_t expires);
+extern int tcwheel_cancel(tcwheel_t *w, tcwheel_handle_t h, void **ret);
+extern int tcwheel_get(tcwheel_t *w, uint64_t now, void **ret);
+extern int tcwheel_get_many(tcwheel_t *w, uint64_t now, void **ret, int n);
+extern int tcwheel_items(tcwheel_t *w);
+extern void tcwheel_free(tcwheel_t *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,20 +26,46 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <pthread.h>
+#include <tchash.h>
+
+#define TCM_SUBSYS TCPROF_ALLOC
+#include "tcm-internal.h"
 
 typedef struct tcattri {
-    char *name;
+    const char *name;		/* Interned, compared by address */
     void *value;
     tcattr_ref_t ref;
     tcfree_fn free;
-    struct tcattri *next;
 } tcattri_t;
 
+/*
+ * The attributes of a block, in the order they were first set.  Up
+ * to ATTR_INLINE of them are searched linearly, beyond that through
+ * an open addressed index of 1-based positions in a[].
+ */
+typedef struct tcattrs {
+    int n, size;
+    unsigned *index;
+    unsigned isize;
+    tcattri_t a[1];
+} tcattrs_t;
+
+#define ATTR_INLINE 4
+
+/*
+ * Block header.  Compact blocks only have rc, which must therefore be
+ * the last field, and the other fields must not be touched when the
+ * TCA_COMPACT flag is set.  Blocks come from the tcmem size classes.
+ */
 typedef struct tcalloc {
-    long rc;
-    tc_ref_fn ref;
+    union {
+	tc_ref_fn ref;
+	struct tcalloc *next;	/* In the deferred free queue */
+    } r;
     tcfree_fn free;
-    tcattri_t *attr;
+    tcattrs_t *attr;
+    long rc;
     union {
 	long l;
 	double d;
@@ -47,26 +73,129 @@ typedef struct tcalloc {
     } data[1];
 } tcalloc_t;
 
-static void tcattr_free(tcattri_t *a);
+/*
+ * Reference counts are updated atomically, unless the object was
+ * allocated with TCALLOC_LOCAL, or libtc is built with
+ * TCALLOC_NONATOMIC defined.  The top bits of rc hold flags.
+ */
+
+#define TCA_ARENA   (1L << (sizeof(long) * 8 - 2))
+#define TCA_LOCAL   (1L << (sizeof(long) * 8 - 3))
+#define TCA_COMPACT (1L << (sizeof(long) * 8 - 4))
+#define TCA_WEAK    (1L << (sizeof(long) * 8 - 5))
+#define TCA_FLAGS   (TCA_ARENA | TCA_LOCAL | TCA_COMPACT | TCA_WEAK)
+
+#define TCA_HDR     offsetof(tcalloc_t, data)
+#define TCA_CHDR    (TCA_HDR - offsetof(tcalloc_t, rc))
+
+#define tca_of(p)   ((tcalloc_t *)((char *) (p) - TCA_HDR))
+
+/* The flags are set at allocation, except TCA_WEAK, which is only set
+ * by a holder of a reference. */
+static inline long
+rc_flags(tcalloc_t *tca)
+{
+    return __atomic_load_n(&tca->rc, __ATOMIC_RELAXED) & TCA_FLAGS;
+}
+
+static inline void
+rc_inc(tcalloc_t *tca, long flags)
+{
+#ifndef TCALLOC_NONATOMIC
+    if(!(flags & TCA_LOCAL)){
+	__atomic_add_fetch(&tca->rc, 1, __ATOMIC_RELAXED);
+	return;
+    }
+#endif
+    tca->rc++;
+}
+
+/* Returns the new rc, flags included.  The last reference sees all
+ * earlier writes to the object by the holders of the others. */
+static inline long
+rc_dec(tcalloc_t *tca)
+{
+#ifndef TCALLOC_NONATOMIC
+    if(!(rc_flags(tca) & TCA_LOCAL))
+	return __atomic_sub_fetch(&tca->rc, 1, __ATOMIC_ACQ_REL);
+#endif
+    return --tca->rc;
+}
+
+static int defer_mode;
+
+static void tcattr_free(tcattrs_t *as);
+static void defer_push(tcalloc_t *tca);
+static void weak_clear(tcalloc_t *tca);
+
+/* Run the destructors of a dead block and free it. */
+static void
+tca_destroy(tcalloc_t *tca, long rc)
+{
+    if(rc_flags(tca) & TCA_WEAK)
+	weak_clear(tca);
+    if(tca->free)
+	tca->free(tca->data);
+    if(tca->attr)
+	tcattr_free(tca->attr);
+    if(!(rc & TCA_ARENA)){
+	tcp_free(tca->data);
+	mem_free(tca);
+    }
+}
+
+extern void *
+tca_allocf(tcarena_t *a, size_t size, tc_ref_fn r, tcfree_fn f,
+	   uint32_t flags, int subsys, const char *tag)
+{
+    tcalloc_t *tca;
+    char *m;
+
+    if(a){
+	if(!(tca = tcarena_alloc(a, size + TCA_HDR)))
+	    return NULL;
+	tca->rc = TCA_ARENA | 1;
+    } else if(flags & TCALLOC_COMPACT){
+	if(r || f || !(m = mem_alloc(size + TCA_CHDR)))
+	    return NULL;
+	tca = (tcalloc_t *)(m - offsetof(tcalloc_t, rc));
+	tca->rc = TCA_COMPACT | 1;
+    } else {
+	tca = flags & TCALLOC_MALLOC? malloc(size + TCA_HDR):
+	    mem_alloc(size + TCA_HDR);
+	if(!tca)
+	    return NULL;
+	tca->rc = 1;
+    }
+    if(!(tca->rc & TCA_COMPACT)){
+	tca->r.ref = r;
+	tca->free = f;
+	tca->attr = NULL;
+    }
+    if(flags & TCALLOC_LOCAL)
+	tca->rc |= TCA_LOCAL;
+    if(flags & TCALLOC_ZERO)
+	memset(tca->data, 0, size);
+
+    return a? tca->data: tcp_alloc(tca->data, size, subsys, tag);
+}
+
+extern void *
+tcallocf(size_t size, tc_ref_fn r, tcfree_fn f, uint32_t flags)
+{
+    return tca_allocf(NULL, size, r, f, flags, TCPROF_ALLOC, __func__);
+}
 
 extern void *
 tcallocd(size_t size, tc_ref_fn r, tcfree_fn f)
 {
-    tcalloc_t *tca = malloc(size + sizeof(tcalloc_t) - sizeof(tca->data));
-    tca->rc = 1;
-    tca->ref = r;
-    tca->free = f;
-    tca->attr = NULL;
-    return tca->data;
+    return tcallocf(size, r, f, 0);
 }
 
 extern void *
 tcallocdz(size_t size, tc_ref_fn r, tcfree_fn f)
 {
-    void *p = tcallocd(size, r, f);
-    if(p)
-	memset(p, 0, size);
-    return p;
+    return tcallocf(size, r, f, TCALLOC_ZERO);
 }
 
 extern void *
@@ -84,10 +213,12 @@ tcallocz(size_t size)
 extern void *
 tcref(void *ptr)
 {
-    tcalloc_t *tca = (tcalloc_t *)((char *) ptr - offsetof(tcalloc_t, data));
-    tca->rc++;
-    if(tca->ref)
-	tca->ref(tca->data);
+    tcalloc_t *tca = tca_of(ptr);
+    long flags = rc_flags(tca);
+
+    rc_inc(tca, flags);
+    if(!(flags & TCA_COMPACT) && tca->r.ref)
+	tca->r.ref(tca->data);
     return ptr;
 }
 
@@ -95,112 +226,552 @@ extern void
 tcfree(void *ptr)
 {
     tcalloc_t *tca;
+    long rc;
 
     if(!ptr)
 	return;
 
-    tca = (tcalloc_t *)((char *) ptr - offsetof(tcalloc_t, data));
-    tca->rc--;
-    if(!tca->rc){
-	tcattri_t *a;
-
-	if(tca->free)
-	    tca->free(tca->data);
-	for(a = tca->attr; a;){
-	    tcattri_t *n = a->next;
-	    tcattr_free(a);
-	    a = n;
+    tca = tca_of(ptr);
+    rc = rc_dec(tca);
+    if(rc & ~TCA_FLAGS)
+	return;
+
+    if(rc & TCA_COMPACT){
+	if(rc & TCA_WEAK)
+	    weak_clear(tca);
+	tcp_free(ptr);
+	mem_free((char *) ptr - TCA_CHDR);
+	return;
+    }
+
+    if(__atomic_load_n(&defer_mode, __ATOMIC_RELAXED) && !(rc & TCA_ARENA))
+	defer_push(tca);
+    else
+	tca_destroy(tca, rc);
+}
+
+/*
+ * Deferred freeing.  Dead blocks are pushed on a lock-free stack,
+ * linked through the ref field, which is unused once rc is zero.
+ * tcfree_drain takes the whole stack at once, so there is no ABA
+ * problem.  Blocks freed by destructors during a drain are pushed
+ * again and handled by the same drain.
+ */
+
+static tcalloc_t *defer_head;
+static pthread_mutex_t defer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t defer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t defer_thread;
+static int defer_running;
+
+static void
+defer_push(tcalloc_t *tca)
+{
+    tcalloc_t *h = __atomic_load_n(&defer_head, __ATOMIC_RELAXED);
+
+    do
+	tca->r.next = h;
+    while(!__atomic_compare_exchange_n(&defer_head, &h, tca, 1,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    /* Wake the reclaimer for the first block of a batch. */
+    if(!h && __atomic_load_n(&defer_mode, __ATOMIC_RELAXED) ==
+       TCFREE_BACKGROUND){
+	pthread_mutex_lock(&defer_lock);
+	pthread_cond_signal(&defer_cond);
+	pthread_mutex_unlock(&defer_lock);
+    }
+}
+
+extern unsigned long
+tcfree_drain(void)
+{
+    unsigned long n = 0;
+    tcalloc_t *tca, *next;
+
+    while((tca = __atomic_exchange_n(&defer_head, NULL, __ATOMIC_ACQUIRE))){
+	for(; tca; tca = next){
+	    next = tca->r.next;
+	    tca_destroy(tca, 0);
+	    n++;
+	}
+    }
+
+    return n;
+}
+
+static void *
+defer_run(void *p)
+{
+    (void) p;
+
+    pthread_mutex_lock(&defer_lock);
+    while(defer_running){
+	if(!__atomic_load_n(&defer_head, __ATOMIC_RELAXED)){
+	    pthread_cond_wait(&defer_cond, &defer_lock);
+	    continue;
 	}
-	free(tca);
+	pthread_mutex_unlock(&defer_lock);
+	tcfree_drain();
+	pthread_mutex_lock(&defer_lock);
     }
+    pthread_mutex_unlock(&defer_lock);
+
+    return NULL;
 }
 
+extern int
+tcfree_defer(int mode)
+{
+    int old;
+
+    if(mode < TCFREE_NOW || mode > TCFREE_BACKGROUND)
+	return -1;
+
+    pthread_mutex_lock(&defer_lock);
+    old = defer_mode;
+    if(mode == TCFREE_BACKGROUND && !defer_running){
+	if(pthread_create(&defer_thread, NULL, defer_run, NULL)){
+	    pthread_mutex_unlock(&defer_lock);
+	    return -1;
+	}
+	defer_running = 1;
+    }
+    __atomic_store_n(&defer_mode, mode, __ATOMIC_RELAXED);
+    if(mode != TCFREE_BACKGROUND && defer_running){
+	defer_running = 0;
+	pthread_cond_signal(&defer_cond);
+	pthread_mutex_unlock(&defer_lock);
+	pthread_join(defer_thread, NULL);
+    } else {
+	pthread_mutex_unlock(&defer_lock);
+    }
+
+    if(mode == TCFREE_NOW)
+	tcfree_drain();
+
+    return old;
+}
+
+/*
+ * Weak references.  A weakly referenced block has the TCA_WEAK flag
+ * and an entry in weak_table, mapping it to a control block shared by
+ * all weak references to it.  The control block is itself a tcalloc
+ * block, with one reference per weak reference and one held by the
+ * table.  Its lock orders tcweak_get against the death of the block:
+ * obj is cleared under the lock before the block is freed.
+ */
+
+struct tcweak {
+    pthread_mutex_t lock;
+    tcalloc_t *obj;
+};
+
+static tchash_table_t *weak_table;
+static pthread_once_t weak_once = PTHREAD_ONCE_INIT;
+
 static void
-tcattr_free(tcattri_t *a)
+weak_init(void)
 {
-    free(a->name);
-    if(a->free)
-	a->free(a->value);
-    free(a);
+    tcarena_t *a = tcarena_use(NULL);
+
+    weak_table = tchash_new(64, 1, 0);
+    tcarena_use(a);
+}
+
+static void
+weak_free(void *p)
+{
+    tcweak_t *w = p;
+
+    pthread_mutex_destroy(&w->lock);
+}
+
+/* The block is dead, detach its weak references. */
+static void
+weak_clear(tcalloc_t *tca)
+{
+    void *data = tca->data;
+    tcweak_t *w;
+
+    if(tchash_delete(weak_table, &data, sizeof(data), &w))
+	return;
+
+    pthread_mutex_lock(&w->lock);
+    w->obj = NULL;
+    pthread_mutex_unlock(&w->lock);
+    tcfree(w);
+}
+
+extern tcweak_t *
+tcweak_new(void *p)
+{
+    tcalloc_t *tca = tca_of(p);
+    tcweak_t *w, *n;
+
+    pthread_once(&weak_once, weak_init);
+    if(!weak_table || !(n = tca_allocd(NULL, sizeof(*n), NULL, weak_free)))
+	return NULL;
+    pthread_mutex_init(&n->lock, NULL);
+    n->obj = tca;
+
+    if(tchash_search(weak_table, &p, sizeof(p), n, &w))
+	__atomic_or_fetch(&tca->rc, TCA_WEAK, __ATOMIC_RELAXED);
+    else
+	tcfree(n);
+
+    return tcref(w);
+}
+
+extern void *
+tcweak_get(tcweak_t *w)
+{
+    tcalloc_t *tca;
+    long rc;
+
+    pthread_mutex_lock(&w->lock);
+    if((tca = w->obj)){
+	rc = __atomic_load_n(&tca->rc, __ATOMIC_RELAXED);
+	do {
+	    if(!(rc & ~TCA_FLAGS)){
+		tca = NULL;
+		break;
+	    }
+	} while(!__atomic_compare_exchange_n(&tca->rc, &rc, rc + 1, 1,
+					     __ATOMIC_ACQUIRE,
+					     __ATOMIC_RELAXED));
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if(!tca)
+	return NULL;
+    if(!(rc & TCA_COMPACT) && tca->r.ref)
+	tca->r.ref(tca->data);
+    return tca->data;
+}
+
+/*
+ * Attribute names are interned in a global table, so the attributes
+ * of a block are matched by address.  Lookups take no lock: a full
+ * table is replaced rather than resized, and the old one is kept for
+ * readers still probing it.  Interned names are never freed.
+ */
+
+typedef struct intern_slot {
+    unsigned long hash;
+    const char *name;
+} intern_slot_t;
+
+typedef struct intern_table {
+    size_t mask, count;
+    struct intern_table *old;
+    intern_slot_t slot[1];
+} intern_table_t;
+
+static intern_table_t *intern_tab;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long
+intern_hash(const char *s)
+{
+    unsigned long h = 2166136261UL;
+
+    while(*s)
+	h = (h ^ (unsigned char) *s++) * 16777619UL;
+
+    return h;
+}
+
+static const char *
+intern_find(intern_table_t *t, const char *name, unsigned long h)
+{
+    const char *s;
+    size_t i;
+
+    for(i = h & t->mask;; i = (i + 1) & t->mask){
+	if(!(s = __atomic_load_n(&t->slot[i].name, __ATOMIC_ACQUIRE)))
+	    return NULL;
+	if(t->slot[i].hash == h && !strcmp(s, name))
+	    return s;
+    }
+}
+
+static void
+intern_put(intern_table_t *t, const char *name, unsigned long h)
+{
+    size_t i;
+
+    for(i = h & t->mask; t->slot[i].name; i = (i + 1) & t->mask);
+    t->slot[i].hash = h;
+    __atomic_store_n(&t->slot[i].name, name, __ATOMIC_RELEASE);
+    t->count++;
+}
+
+/* Return the interned copy of name.  If there is none, add one if
+ * add is set, else return NULL. */
+static const char *
+attr_intern(const char *name, int add)
+{
+    unsigned long h = intern_hash(name);
+    intern_table_t *t, *nt;
+    const char *s;
+    size_t i, size;
+
+    t = __atomic_load_n(&intern_tab, __ATOMIC_ACQUIRE);
+    if(t && (s = intern_find(t, name, h)))
+	return s;
+    if(!add)
+	return NULL;
+
+    pthread_mutex_lock(&intern_lock);
+    t = intern_tab;
+    if(t && (s = intern_find(t, name, h)))
+	goto out;
+
+    if(!t || (t->count + 1) * 4 > (t->mask + 1) * 3){
+	size = t? (t->mask + 1) * 2: 64;
+	nt = calloc(1, sizeof(*nt) + (size - 1) * sizeof(nt->slot[0]));
+	s = NULL;
+	if(!nt)
+	    goto out;
+	nt->mask = size - 1;
+	nt->old = t;
+	for(i = 0; t && i <= t->mask; i++)
+	    if(t->slot[i].name)
+		intern_put(nt, t->slot[i].name, t->slot[i].hash);
+	__atomic_store_n(&intern_tab, nt, __ATOMIC_RELEASE);
+	t = nt;
+    }
+
+    if((s = strdup(name)))
+	intern_put(t, s, h);
+out:
+    pthread_mutex_unlock(&intern_lock);
+    return s;
+}
+
+static inline unsigned
+attr_slot(const char *name, unsigned isize)
+{
+    return ((uintptr_t) name >> 4) * 2654435761U & (isize - 1);
+}
+
+static void
+attr_index(tcattrs_t *as, int i)
+{
+    unsigned j;
+
+    for(j = attr_slot(as->a[i].name, as->isize); as->index[j];
+	j = (j + 1) & (as->isize - 1));
+    as->index[j] = i + 1;
+}
+
+/* Rebuild the index after the attributes moved or it filled up. */
+static int
+attr_reindex(tcattrs_t *as)
+{
+    unsigned isize = as->isize;
+    int i;
+
+    if(as->n <= ATTR_INLINE){
+	tcm_free(as->index);
+	as->index = NULL;
+	as->isize = 0;
+	return 0;
+    }
+
+    while(isize < (unsigned) as->n * 2)
+	isize = isize? isize * 2: 4 * ATTR_INLINE;
+    if(isize != as->isize){
+	unsigned *index = tcm_alloc(isize * sizeof(*index));
+	if(!index)
+	    return -1;
+	tcm_free(as->index);
+	as->index = index;
+	as->isize = isize;
+    }
+
+    memset(as->index, 0, as->isize * sizeof(*as->index));
+    for(i = 0; i < as->n; i++)
+	attr_index(as, i);
+
+    return 0;
+}
+
+/* Position of the interned name in the index of as, or -1. */
+static int
+attr_find(tcattrs_t *as, const char *name)
+{
+    unsigned j, k;
+
+    for(j = attr_slot(name, as->isize); (k = as->index[j]);
+	j = (j + 1) & (as->isize - 1))
+	if(as->a[k - 1].name == name)
+	    return k - 1;
+
+    return -1;
+}
+
+static void
+tcattr_free(tcattrs_t *as)
+{
+    int i;
+
+    for(i = 0; i < as->n; i++)
+	if(as->a[i].free)
+	    as->a[i].free(as->a[i].value);
+    tcm_free(as->index);
+    tcm_free(as);
+}
+
+/* Compact blocks have no attributes. */
+static inline tcattrs_t *
+tca_attrs(tcalloc_t *tca)
+{
+    return rc_flags(tca) & TCA_COMPACT? NULL: tca->attr;
+}
+
+extern char *
+tcattr_intern(char *name)
+{
+    return (char *) attr_intern(name, 1);
+}
+
+/*
+ * Position of name in as, or -1.  Interned names are matched by
+ * address alone.  Up to ATTR_INLINE attributes comparing the strings
+ * is cheaper than hashing, so names are only interned when indexing
+ * or adding.  If add is set, *in receives the interned name.
+ */
+static int
+attr_lookup(tcattrs_t *as, const char *name, int add, const char **in)
+{
+    int i;
+
+    *in = name;
+    if(!as || !as->index){
+	for(i = 0; as && i < as->n; i++)
+	    if(as->a[i].name == name)
+		return i;
+	for(i = 0; as && i < as->n; i++)
+	    if(!strcmp(as->a[i].name, name))
+		return i;
+	if(add)
+	    *in = attr_intern(name, 1);
+	return -1;
+    }
+
+    if((i = attr_find(as, name)) >= 0)
+	return i;
+    if(!(*in = attr_intern(name, add)) || *in == name)
+	return -1;
+    return attr_find(as, *in);
 }
 
 extern int
 tcattr_set(void *ptr, char *name, void *val, tcattr_ref_t r, tcfree_fn f)
 {
-    tcalloc_t *tca = (tcalloc_t *)((char *) ptr - offsetof(tcalloc_t, data));
-    tcattri_t *a, *n, *p = NULL;
-
-    for(a = tca->attr; a && a->next && strcmp(name, a->name); a = a->next)
-	p = a;
+    tcalloc_t *tca = tca_of(ptr);
+    tcattrs_t *as;
+    tcattri_t *a;
+    const char *in;
+    int i;
 
-    n = calloc(1, sizeof(*n));
-    n->name = strdup(name);
-    n->value = val;
-    n->ref = r;
-    n->free = f;
+    if(rc_flags(tca) & TCA_COMPACT)
+	return -1;
 
-    if(!a){
-	tca->attr = n;
-    } else if(strcmp(name, a->name)){
-	a->next = n;
+    as = tca->attr;
+    if((i = attr_lookup(as, name, 1, &in)) >= 0){
+	a = as->a + i;
+	if(a->free)
+	    a->free(a->value);
     } else {
-	n->next = a->next;
-	if(p)
-	    p->next = n;
-	else
-	    tca->attr = n;
-	tcattr_free(a);
+	if(!in)
+	    return -1;
+	if(!as || as->n == as->size){
+	    int size = as? as->size * 2: 2;
+	    tcattrs_t *nas = tcm_realloc(as, sizeof(*as) +
+					 (size - 1) * sizeof(as->a[0]));
+	    if(!nas)
+		return -1;
+	    if(!as){
+		nas->n = 0;
+		nas->index = NULL;
+		nas->isize = 0;
+	    }
+	    nas->size = size;
+	    tca->attr = as = nas;
+	}
+
+	a = as->a + as->n++;
+	a->name = in;
+	if(as->n > ATTR_INLINE){
+	    if(as->index && (unsigned) as->n * 2 <= as->isize){
+		attr_index(as, as->n - 1);
+	    } else if(attr_reindex(as)){
+		as->n--;
+		return -1;
+	    }
+	}
     }
 
+    a->value = val;
+    a->ref = r;
+    a->free = f;
+
     return 0;
 }
 
 extern void *
 tcattr_get(void *p, char *name)
 {
-    tcalloc_t *tca = (tcalloc_t *)((char *) p - offsetof(tcalloc_t, data));
+    tcattrs_t *as = tca_attrs(tca_of(p));
+    const char *in;
     tcattri_t *a;
-    void *v = NULL;
-
-    for(a = tca->attr; a && strcmp(name, a->name); a = a->next);
+    int i;
 
-    if(a)
-	v = a->ref? a->ref(a->value): a->value;
+    if((i = attr_lookup(as, name, 0, &in)) < 0)
+	return NULL;
 
-    return v;
+    a = as->a + i;
+    return a->ref? a->ref(a->value): a->value;
 }
 
 extern int
 tcattr_getall(void *p, int n, tcattr_t *attr)
 {
-    tcalloc_t *tca = (tcalloc_t *)((char *) p - offsetof(tcalloc_t, data));
-    tcattri_t *a;
+    tcattrs_t *as = tca_attrs(tca_of(p));
     int i;
 
-    for(i = 0, a = tca->attr; a && i < n; a = a->next, i++){
-	attr[i].name = a->name;
-	attr[i].value = a->ref? a->ref(a->value): a->value;
+    for(i = 0; as && i < as->n && i < n; i++){
+	attr[i].name = (char *) as->a[i].name;
+	attr[i].value = as->a[i].ref?
+	    as->a[i].ref(as->a[i].value): as->a[i].value;
     }
 
     return i;
 }
 
+/* Deleting keeps the order of the others, and so moves them and
+ * rebuilds the index.  Attributes are rarely deleted. */
 extern int
 tcattr_del(void *ptr, char *name)
 {
-    tcalloc_t *tca = (tcalloc_t *)((char *) ptr - offsetof(tcalloc_t, data));
-    tcattri_t *a, *p = NULL;
+    tcattrs_t *as = tca_attrs(tca_of(ptr));
+    const char *in;
+    tcattri_t a;
+    int i;
 
-    for(a = tca->attr; a && strcmp(name, a->name); a = a->next)
-	p = a;
+    if((i = attr_lookup(as, name, 0, &in)) < 0)
+	return 0;
 
-    if(a){
-	if(p)
-	    p->next = a->next;
-	else
-	    tca->attr = a->next;
-	tcattr_free(a);
-    }
+    a = as->a[i];
+    memmove(as->a + i, as->a + i + 1, (as->n - i - 1) * sizeof(as->a[0]));
+    as->n--;
+    if(as->index)
+	attr_reindex(as);	/* Cannot fail, the index only shrinks */
+    if(a.free)
+	a.free(a.value);
 
     return 0;
 }
@@ -0,0 +1,225 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * Bump pointer arena.  Memory is handed out from the current block by
+ * moving a pointer, and is only released all at once.  Blocks are kept
+ * on reset for the next round, except for the ones made for requests
+ * too big to share a block, which go back to the system.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <tcarena.h>
+#include <tcalloc.h>
+
+#define TCM_SUBSYS TCPROF_ARENA
+#include "tcm-internal.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK (64 << 10)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    union {
+	long l;
+	double d;
+	void *p;
+    } data[1];
+} arena_block_t;
+
+#define BLOCK_HDR ((offsetof(arena_block_t, data) + ARENA_ALIGN - 1) & \
+		   ~(ARENA_ALIGN - 1))
+
+struct tcarena {
+    char *ptr, *end;
+    arena_block_t *blocks, *last;	/* In use, newest first. */
+    arena_block_t *spare;		/* Kept by tcarena_reset. */
+    arena_block_t *large;
+    size_t block;
+    int locking;
+    pthread_mutex_t lock;
+};
+
+__thread tcarena_t *tcarena_current;
+
+static inline void
+arena_lock(tcarena_t *a)
+{
+    if(a->locking)
+	pthread_mutex_lock(&a->lock);
+}
+
+static inline void
+arena_unlock(tcarena_t *a)
+{
+    if(a->locking)
+	pthread_mutex_unlock(&a->lock);
+}
+
+static void
+free_blocks(arena_block_t *b)
+{
+    arena_block_t *n;
+
+    for(; b; b = n){
+	n = b->next;
+	tcp_free(b);
+	free(b);
+    }
+}
+
+static void
+arena_free(void *p)
+{
+    tcarena_t *a = p;
+
+    free_blocks(a->blocks);
+    free_blocks(a->spare);
+    free_blocks(a->large);
+    pthread_mutex_destroy(&a->lock);
+}
+
+extern tcarena_t *
+tcarena_new(size_t block, int lock)
+{
+    tcarena_t *a = tca_allocdz(NULL, sizeof(*a), NULL, arena_free);
+
+    if(!a)
+	return NULL;
+
+    a->block = block? (block + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1):
+	ARENA_BLOCK;
+    a->locking = lock;
+    pthread_mutex_init(&a->lock, NULL);
+
+    return a;
+}
+
+static inline void *
+align_ptr(void *p, size_t align)
+{
+    return (void *) (((uintptr_t) p + align - 1) & ~(uintptr_t) (align - 1));
+}
+
+static void *
+arena_get(tcarena_t *a, size_t align, size_t size)
+{
+    arena_block_t *b;
+    char *p;
+
+    if(!size)
+	size = 1;
+
+    p = align_ptr(a->ptr, align);
+    if(a->ptr && p + size <= a->end){
+	a->ptr = p + size;
+	return p;
+    }
+
+    /* Too big to share a block. */
+    if(size + align > a->block / 4){
+	size_t bs = BLOCK_HDR + size + align - ARENA_ALIGN;
+	if(!(b = tcp_alloc(malloc(bs), bs, TCM_SUBSYS, __func__)))
+	    return NULL;
+	b->next = a->large;
+	a->large = b;
+	return align_ptr((char *) b + BLOCK_HDR, align);
+    }
+
+    if((b = a->spare)){
+	a->spare = b->next;
+    } else if(!(b = tcp_alloc(malloc(BLOCK_HDR + a->block),
+			       BLOCK_HDR + a->block, TCM_SUBSYS, __func__))){
+	return NULL;
+    }
+
+    if(!a->blocks)
+	a->last = b;
+    b->next = a->blocks;
+    a->blocks = b;
+    a->end = (char *) b + BLOCK_HDR + a->block;
+
+    p = align_ptr((char *) b + BLOCK_HDR, align);
+    a->ptr = p + size;
+    return p;
+}
+
+extern void *
+tcarena_alloc(tcarena_t *a, size_t size)
+{
+    void *p;
+
+    arena_lock(a);
+    p = arena_get(a, ARENA_ALIGN, size);
+    arena_unlock(a);
+
+    return p;
+}
+
+extern void *
+tcarena_memalign(tcarena_t *a, size_t align, size_t size)
+{
+    void *p;
+
+    if(align < ARENA_ALIGN)
+	align = ARENA_ALIGN;
+    if(align & (align - 1))
+	return NULL;
+
+    arena_lock(a);
+    p = arena_get(a, align, size);
+    arena_unlock(a);
+
+    return p;
+}
+
+extern void
+tcarena_reset(tcarena_t *a)
+{
+    arena_lock(a);
+
+    free_blocks(a->large);
+    a->large = NULL;
+
+    if(a->blocks){
+	a->last->next = a->spare;
+	a->spare = a->blocks;
+	a->blocks = NULL;
+    }
+    a->ptr = a->end = NULL;
+
+    arena_unlock(a);
+}
+
+extern tcarena_t *
+tcarena_use(tcarena_t *a)
+{
+    tcarena_t *o = tcarena_current;
+
+    tcarena_current = a;
+    return o;
+}
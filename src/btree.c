@@ -0,0 +1,754 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * B+-tree engine for tctree.  Keys are stored in contiguous arrays in
+ * fixed size blocks, and lookups need only one cache miss or so per
+ * level instead of one per key compared.  All keys live in the leaves,
+ * which are linked for iteration.  Interior nodes hold separator keys
+ * only: every key below child i of a node is greater than or equal to
+ * key i-1 and less than key i.  Separators are not removed when the key
+ * they were copied from is deleted, since they still route correctly.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "tct-internal.h"
+
+#define TCM_SUBSYS TCPROF_TREE
+#include "tcm-internal.h"
+
+struct btnode {
+    int level;
+    int count;
+    btnode_t *next, *prev;
+    void *keys[1];
+};
+
+#define BTREE_NODESIZE     1024
+#define BTREE_NODESIZE_MIN 256
+#define BTREE_NODESIZE_MAX 4096
+#define BTREE_ALIGN        64
+#define BTREE_DEPTH_MAX    32
+#define BTREE_LINEAR       32
+
+#define BTREE_ICAP_MAX (BTREE_NODESIZE_MAX / (2 * sizeof(void *)))
+
+#define bt_children(t, n) ((btnode_t **) ((n)->keys + (t)->icap))
+
+static int
+bt_setcaps(tctree_t *t, size_t size)
+{
+    size_t hs = offsetof(btnode_t, keys);
+
+    if(size < BTREE_NODESIZE_MIN || size > BTREE_NODESIZE_MAX)
+	return -1;
+
+    t->nodesize = size;
+    t->lcap = (size - hs) / sizeof(void *);
+    t->icap = (size - hs - sizeof(void *)) / (2 * sizeof(void *));
+
+    return 0;
+}
+
+extern void
+btree_init(tctree_t *t)
+{
+    t->broot = NULL;
+    bt_setcaps(t, BTREE_NODESIZE);
+}
+
+extern int
+btree_setnodesize(tctree_t *t, size_t size)
+{
+    if(t->broot)
+	return -1;
+    return bt_setcaps(t, size);
+}
+
+static inline void
+bt_release(tctree_t *t, btnode_t *n)
+{
+    if(!t->arena){
+	tcp_free(n);
+	free(n);
+    }
+}
+
+static btnode_t *
+bt_alloc(tctree_t *t, int level)
+{
+    btnode_t *n;
+    void *p;
+
+    if(t->arena){
+	if(!(p = tcarena_memalign(t->arena, BTREE_ALIGN, t->nodesize)))
+	    return NULL;
+    } else if(posix_memalign(&p, BTREE_ALIGN, t->nodesize)){
+	return NULL;
+    } else {
+	tcp_alloc(p, t->nodesize, TCM_SUBSYS, __func__);
+    }
+
+    n = p;
+    n->level = level;
+    n->count = 0;
+    n->next = NULL;
+    n->prev = NULL;
+
+    return n;
+}
+
+/*
+ * Binary search within a node.  Return the index of the first key
+ * greater than key if upper is set, otherwise the first key greater
+ * than or equal to key.  For interior nodes, the index of the first
+ * separator greater than key is also the index of the child to
+ * descend to.
+ */
+
+static inline int
+bt_pos_type(tctree_t *t, btnode_t *n, void *key, int upper, int type)
+{
+    int lo = 0, hi = n->count;
+
+    while(hi - lo > (type == tct_key_int? BTREE_LINEAR: 0)){
+	int mid = (lo + hi) / 2;
+	int result = tct_keycmp(t, type, key, n->keys[mid]);
+	if(result > 0 || (result == 0 && upper))
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    /*
+     * Finish integer searches by counting the smaller keys left in
+     * the window.  There are no branches to mispredict, and the
+     * compiler can vectorise the loop.
+     */
+    if(type == tct_key_int){
+	intptr_t k = (intptr_t) key;
+	int i, c = 0;
+	if(upper)
+	    for(i = lo; i < hi; i++)
+		c += (intptr_t) n->keys[i] <= k;
+	else
+	    for(i = lo; i < hi; i++)
+		c += (intptr_t) n->keys[i] < k;
+	lo += c;
+    }
+
+    return lo;
+}
+
+static int
+bt_pos(tctree_t *t, btnode_t *n, void *key, int upper)
+{
+    switch(t->keytype){
+    case tct_key_int:
+	return bt_pos_type(t, n, key, upper, tct_key_int);
+    case tct_key_u64:
+	return bt_pos_type(t, n, key, upper, tct_key_u64);
+    case tct_key_str:
+	return bt_pos_type(t, n, key, upper, tct_key_str);
+    }
+    return bt_pos_type(t, n, key, upper, tct_key_fn);
+}
+
+static btnode_t *
+bt_leaf(tctree_t *t, void *key)
+{
+    btnode_t *n = t->broot;
+
+    while(n->level)
+	n = bt_children(t, n)[bt_pos(t, n, key, 1)];
+
+    return n;
+}
+
+extern void **
+btree_find(tctree_t *t, void *key)
+{
+    btnode_t *n;
+    int i;
+
+    if(!t->broot)
+	return NULL;
+
+    n = bt_leaf(t, key);
+    i = bt_pos(t, n, key, 0);
+    if(i < n->count && !tct_compare(t, key, n->keys[i]))
+	return &n->keys[i];
+
+    return NULL;
+}
+
+/*
+ * Insert a separator and the child to its right into a full interior
+ * node, splitting it in two.  The new right node is returned, and
+ * the separator between the halves stored in *sep.
+ */
+
+static btnode_t *
+bt_split_interior(tctree_t *t, btnode_t *n, int i, void **sep,
+		  btnode_t *right)
+{
+    void *kt[BTREE_ICAP_MAX + 1];
+    btnode_t *ct[BTREE_ICAP_MAX + 2];
+    btnode_t **ch = bt_children(t, n);
+    btnode_t *nn;
+    int m;
+
+    memcpy(kt, n->keys, i * sizeof(*kt));
+    kt[i] = *sep;
+    memcpy(kt + i + 1, n->keys + i, (n->count - i) * sizeof(*kt));
+
+    memcpy(ct, ch, (i + 1) * sizeof(*ct));
+    ct[i + 1] = right;
+    memcpy(ct + i + 2, ch + i + 1, (n->count - i) * sizeof(*ct));
+
+    m = (t->icap + 1) / 2;
+    nn = bt_alloc(t, n->level);
+
+    n->count = m;
+    memcpy(n->keys, kt, m * sizeof(*kt));
+    memcpy(ch, ct, (m + 1) * sizeof(*ct));
+
+    nn->count = t->icap - m;
+    memcpy(nn->keys, kt + m + 1, nn->count * sizeof(*kt));
+    memcpy(bt_children(t, nn), ct + m + 1, (nn->count + 1) * sizeof(*ct));
+
+    *sep = kt[m];
+    return nn;
+}
+
+/*
+ * Insert key at position i in a full leaf, splitting it in two.
+ * Returns the new right leaf.
+ */
+
+static btnode_t *
+bt_split_leaf(tctree_t *t, btnode_t *n, int i, void *key)
+{
+    btnode_t *nn = bt_alloc(t, 0);
+    int lk = (t->lcap + 1) / 2;
+
+    if(i < lk){
+	nn->count = t->lcap - lk + 1;
+	memcpy(nn->keys, n->keys + lk - 1, nn->count * sizeof(*n->keys));
+	memmove(n->keys + i + 1, n->keys + i, (lk - 1 - i) * sizeof(*n->keys));
+	n->keys[i] = key;
+    } else {
+	nn->count = t->lcap - lk + 1;
+	memcpy(nn->keys, n->keys + lk, (i - lk) * sizeof(*n->keys));
+	nn->keys[i - lk] = key;
+	memcpy(nn->keys + i - lk + 1, n->keys + i,
+	       (t->lcap - i) * sizeof(*n->keys));
+    }
+    n->count = lk;
+
+    nn->next = n->next;
+    nn->prev = n;
+    if(n->next)
+	n->next->prev = nn;
+    n->next = nn;
+
+    return nn;
+}
+
+extern int
+btree_search(tctree_t *t, void *key, void *r, int replace)
+{
+    btnode_t *path[BTREE_DEPTH_MAX];
+    int pidx[BTREE_DEPTH_MAX];
+    btnode_t *n, *right;
+    void **ret = r;
+    void *sep;
+    int d = 0, i;
+
+    if(!t->broot)
+	t->broot = bt_alloc(t, 0);
+
+    n = t->broot;
+    while(n->level){
+	i = bt_pos(t, n, key, 1);
+	path[d] = n;
+	pidx[d++] = i;
+	n = bt_children(t, n)[i];
+    }
+
+    i = bt_pos(t, n, key, 0);
+    if(i < n->count && !tct_compare(t, key, n->keys[i])){
+	if(ret)
+	    *ret = n->keys[i];
+	if(replace)
+	    n->keys[i] = key;
+	return 0;
+    }
+
+    if(ret)
+	*ret = key;
+
+    t->nodecount++;
+    t->gen++;
+
+    if(n->count < t->lcap){
+	memmove(n->keys + i + 1, n->keys + i, (n->count - i) * sizeof(*n->keys));
+	n->keys[i] = key;
+	n->count++;
+	return 1;
+    }
+
+    right = bt_split_leaf(t, n, i, key);
+    sep = right->keys[0];
+
+    while(d > 0){
+	btnode_t **ch;
+
+	n = path[--d];
+	i = pidx[d];
+
+	if(n->count == t->icap){
+	    right = bt_split_interior(t, n, i, &sep, right);
+	    continue;
+	}
+
+	ch = bt_children(t, n);
+	memmove(n->keys + i + 1, n->keys + i, (n->count - i) * sizeof(*n->keys));
+	memmove(ch + i + 2, ch + i + 1, (n->count - i) * sizeof(*ch));
+	n->keys[i] = sep;
+	ch[i + 1] = right;
+	n->count++;
+	return 1;
+    }
+
+    /* the root was split */
+    n = bt_alloc(t, t->broot->level + 1);
+    n->count = 1;
+    n->keys[0] = sep;
+    bt_children(t, n)[0] = t->broot;
+    bt_children(t, n)[1] = right;
+    t->broot = n;
+
+    return 1;
+}
+
+/*
+ * Move one key from the left sibling l of n through the parent p.
+ * n is child i of p.
+ */
+
+static void
+bt_borrow_left(tctree_t *t, btnode_t *p, int i, btnode_t *l, btnode_t *n)
+{
+    memmove(n->keys + 1, n->keys, n->count * sizeof(*n->keys));
+
+    if(n->level){
+	btnode_t **nc = bt_children(t, n);
+	memmove(nc + 1, nc, (n->count + 1) * sizeof(*nc));
+	n->keys[0] = p->keys[i - 1];
+	nc[0] = bt_children(t, l)[l->count];
+	p->keys[i - 1] = l->keys[l->count - 1];
+    } else {
+	n->keys[0] = l->keys[l->count - 1];
+	p->keys[i - 1] = n->keys[0];
+    }
+
+    l->count--;
+    n->count++;
+}
+
+static void
+bt_borrow_right(tctree_t *t, btnode_t *p, int i, btnode_t *n, btnode_t *r)
+{
+    if(n->level){
+	btnode_t **rc = bt_children(t, r);
+	n->keys[n->count] = p->keys[i];
+	bt_children(t, n)[n->count + 1] = rc[0];
+	p->keys[i] = r->keys[0];
+	memmove(rc, rc + 1, r->count * sizeof(*rc));
+    } else {
+	n->keys[n->count] = r->keys[0];
+    }
+
+    memmove(r->keys, r->keys + 1, (r->count - 1) * sizeof(*r->keys));
+    r->count--;
+    n->count++;
+
+    if(!n->level)
+	p->keys[i] = r->keys[0];
+}
+
+/*
+ * Merge r, child s+1 of p, into its left sibling l and remove it
+ * from p together with the separator between them.
+ */
+
+static void
+bt_merge(tctree_t *t, btnode_t *p, int s, btnode_t *l, btnode_t *r)
+{
+    btnode_t **pc = bt_children(t, p);
+
+    if(l->level){
+	l->keys[l->count] = p->keys[s];
+	memcpy(l->keys + l->count + 1, r->keys, r->count * sizeof(*r->keys));
+	memcpy(bt_children(t, l) + l->count + 1, bt_children(t, r),
+	       (r->count + 1) * sizeof(*pc));
+	l->count += r->count + 1;
+    } else {
+	memcpy(l->keys + l->count, r->keys, r->count * sizeof(*r->keys));
+	l->count += r->count;
+	l->next = r->next;
+	if(r->next)
+	    r->next->prev = l;
+    }
+
+    memmove(p->keys + s, p->keys + s + 1, (p->count - s - 1) * sizeof(*p->keys));
+    memmove(pc + s + 1, pc + s + 2, (p->count - s - 1) * sizeof(*pc));
+    p->count--;
+
+    bt_release(t, r);
+}
+
+extern int
+btree_delete(tctree_t *t, void *key, void *r)
+{
+    btnode_t *path[BTREE_DEPTH_MAX];
+    int pidx[BTREE_DEPTH_MAX];
+    btnode_t *n;
+    void **ret = r;
+    int d = 0, i;
+
+    if(!t->broot)
+	return 1;
+
+    n = t->broot;
+    while(n->level){
+	i = bt_pos(t, n, key, 1);
+	path[d] = n;
+	pidx[d++] = i;
+	n = bt_children(t, n)[i];
+    }
+
+    i = bt_pos(t, n, key, 0);
+    if(i == n->count || tct_compare(t, key, n->keys[i]))
+	return 1;
+
+    if(ret)
+	*ret = n->keys[i];
+
+    memmove(n->keys + i, n->keys + i + 1, (n->count - i - 1) * sizeof(*n->keys));
+    n->count--;
+
+    t->nodecount--;
+    t->gen++;
+
+    while(d > 0){
+	int min = n->level? t->icap / 2: t->lcap / 2;
+	btnode_t *p, *left, *right;
+
+	if(n->count >= min)
+	    return 0;
+
+	p = path[--d];
+	i = pidx[d];
+	left = i > 0? bt_children(t, p)[i - 1]: NULL;
+	right = i < p->count? bt_children(t, p)[i + 1]: NULL;
+
+	if(left && left->count > min){
+	    bt_borrow_left(t, p, i, left, n);
+	    return 0;
+	}
+	if(right && right->count > min){
+	    bt_borrow_right(t, p, i, n, right);
+	    return 0;
+	}
+
+	if(left)
+	    bt_merge(t, p, i - 1, left, n);
+	else
+	    bt_merge(t, p, i, n, right);
+
+	n = p;
+    }
+
+    if(!n->count){
+	t->broot = n->level? bt_children(t, n)[0]: NULL;
+	bt_release(t, n);
+    }
+
+    return 0;
+}
+
+static void
+bt_free(tctree_t *t, btnode_t *n)
+{
+    if(t->arena)
+	return;
+
+    if(n->level){
+	btnode_t **ch = bt_children(t, n);
+	int i;
+	for(i = 0; i <= n->count; i++)
+	    bt_free(t, ch[i]);
+    }
+    tcp_free(n);
+    free(n);
+}
+
+extern void
+btree_destroy(tctree_t *t, tcfree_fn f)
+{
+    btnode_t *n;
+    int i;
+
+    if(!t->broot)
+	return;
+
+    if(f){
+	for(n = t->broot; n->level; n = bt_children(t, n)[0]);
+	for(; n; n = n->next)
+	    for(i = 0; i < n->count; i++)
+		f(n->keys[i]);
+    }
+
+    bt_free(t, t->broot);
+    t->broot = NULL;
+}
+
+extern void **
+btree_first(tctree_t *t, btnode_t **np, int *ip)
+{
+    btnode_t *n = t->broot;
+
+    if(!n)
+	return NULL;
+
+    while(n->level)
+	n = bt_children(t, n)[0];
+
+    *np = n;
+    *ip = 0;
+    return &n->keys[0];
+}
+
+extern void **
+btree_last(tctree_t *t, btnode_t **np, int *ip)
+{
+    btnode_t *n = t->broot;
+
+    if(!n)
+	return NULL;
+
+    while(n->level)
+	n = bt_children(t, n)[n->count];
+
+    *np = n;
+    *ip = n->count - 1;
+    return &n->keys[n->count - 1];
+}
+
+extern void **
+btree_next(btnode_t **np, int *ip)
+{
+    btnode_t *n = *np;
+    int i = *ip + 1;
+
+    if(i == n->count){
+	n = n->next;
+	i = 0;
+	if(!n)
+	    return NULL;
+    }
+
+    *np = n;
+    *ip = i;
+    return &n->keys[i];
+}
+
+extern void **
+btree_prev(btnode_t **np, int *ip)
+{
+    btnode_t *n = *np;
+    int i = *ip - 1;
+
+    if(i < 0){
+	n = n->prev;
+	if(!n)
+	    return NULL;
+	i = n->count - 1;
+    }
+
+    *np = n;
+    *ip = i;
+    return &n->keys[i];
+}
+
+/*
+ * Locate the smallest key greater than (or equal to, if incl is set)
+ * key.  Keys equal to a separator are always to its right, so the
+ * answer is either in the leaf the key routes to or first in the next.
+ */
+
+extern void **
+btree_ceil(tctree_t *t, void *key, int incl, btnode_t **np, int *ip)
+{
+    btnode_t *n;
+    int i;
+
+    if(!t->broot)
+	return NULL;
+
+    n = bt_leaf(t, key);
+    i = bt_pos(t, n, key, !incl);
+    if(i == n->count){
+	n = n->next;
+	i = 0;
+	if(!n)
+	    return NULL;
+    }
+
+    *np = n;
+    *ip = i;
+    return &n->keys[i];
+}
+
+extern void **
+btree_floor(tctree_t *t, void *key, int incl, btnode_t **np, int *ip)
+{
+    btnode_t *n;
+    int i;
+
+    if(!t->broot)
+	return NULL;
+
+    n = bt_leaf(t, key);
+    i = bt_pos(t, n, key, incl) - 1;
+    if(i < 0){
+	n = n->prev;
+	if(!n)
+	    return NULL;
+	i = n->count - 1;
+    }
+
+    *np = n;
+    *ip = i;
+    return &n->keys[i];
+}
+
+extern unsigned long
+btree_collect(tctree_t *t, void **keys)
+{
+    btnode_t *n = t->broot;
+    unsigned long k = 0;
+
+    if(!n)
+	return 0;
+
+    while(n->level)
+	n = bt_children(t, n)[0];
+
+    for(; n; n = n->next){
+	memcpy(keys + k, n->keys, n->count * sizeof(*keys));
+	k += n->count;
+    }
+
+    return k;
+}
+
+/*
+ * Replace the contents of the tree with n sorted keys, filling the
+ * nodes one level at a time from the leaves up.  Spreading the keys
+ * or children evenly over the fewest nodes that can hold them leaves
+ * every node at least half full.
+ */
+
+extern void
+btree_build(tctree_t *t, void **keys, unsigned long n)
+{
+    btnode_t **nodes;
+    void **low;
+    unsigned long nn, per, extra, i, j, k;
+    int level = 0;
+
+    if(t->broot)
+	bt_free(t, t->broot);
+    t->broot = NULL;
+
+    if(!n)
+	return;
+
+    nn = (n + t->lcap - 1) / t->lcap;
+    nodes = tcm_alloc(nn * sizeof(*nodes));
+    low = tcm_alloc(nn * sizeof(*low));
+
+    per = n / nn;
+    extra = n % nn;
+    for(i = 0, k = 0; i < nn; i++){
+	btnode_t *l = bt_alloc(t, 0);
+	l->count = per + (i < extra);
+	memcpy(l->keys, keys + k, l->count * sizeof(*keys));
+	k += l->count;
+	if(i){
+	    l->prev = nodes[i - 1];
+	    nodes[i - 1]->next = l;
+	}
+	nodes[i] = l;
+	low[i] = l->keys[0];
+    }
+
+    while(nn > 1){
+	unsigned long np = (nn + t->icap) / (t->icap + 1);
+
+	per = nn / np;
+	extra = nn % np;
+	level++;
+
+	for(i = 0, k = 0; i < np; i++){
+	    btnode_t *p = bt_alloc(t, level);
+	    btnode_t **ch = bt_children(t, p);
+	    unsigned long c = per + (i < extra);
+	    void *l0 = low[k];
+
+	    for(j = 0; j < c; j++){
+		ch[j] = nodes[k + j];
+		if(j)
+		    p->keys[j - 1] = low[k + j];
+	    }
+	    p->count = c - 1;
+
+	    nodes[i] = p;
+	    low[i] = l0;
+	    k += c;
+	}
+
+	nn = np;
+    }
+
+    t->broot = nodes[0];
+
+    tcm_free(nodes);
+    tcm_free(low);
+}
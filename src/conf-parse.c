@@ -1007,17 +1007,17 @@ tcc_addfloat(cur_entry, strtod(yytext, NULL));
 case 11:
 YY_RULE_SETUP
 #line 136 "../../../libtc/src/conf-parse.l"
-yytext[yyleng-1]=0; tcc_addstring(cur_entry,strdup(yytext+1),0);
+yytext[yyleng-1]=0; tcc_addstring(cur_entry,tcc_strdup(yytext+1),0);
 	YY_BREAK
 case 12:
 YY_RULE_SETUP
 #line 137 "../../../libtc/src/conf-parse.l"
-yytext[yyleng-1]=0; tcc_addstring(cur_entry,strdup(yytext+1),1);
+yytext[yyleng-1]=0; tcc_addstring(cur_entry,tcc_strdup(yytext+1),1);
 	YY_BREAK
 case 13:
 YY_RULE_SETUP
 #line 138 "../../../libtc/src/conf-parse.l"
-tcc_addref(cur_entry, strdup(yytext));
+tcc_addref(cur_entry, tcc_strdup(yytext));
 	YY_BREAK
 case 14:
 YY_RULE_SETUP
@@ -1085,7 +1085,7 @@ case 21:
 YY_RULE_SETUP
 #line 172 "../../../libtc/src/conf-parse.l"
 {
-    tclist_push(cur_section->merge, strdup(yytext));
+    tclist_push(cur_section->merge, tcc_strdup(yytext));
     BEGIN(sect);
 }
 	YY_BREAK
@@ -35,6 +35,9 @@
 #include <tcconf.h>
 #include "tcc-internal.h"
 
+#define TCM_SUBSYS TCPROF_CONF
+#include "tcm-internal.h"
+
 static int tcc_writeentry(tcc_entry *, void *file, int lv, tcio_fn);
 static int tcc_writesection(conf_section *ts, void *file, int lv,
 			    char *d, tcio_fn);
@@ -77,14 +80,19 @@ extern tcconf_section_t *
 tcconf_load(tcconf_section_t *ts, void *data, tcio_fn rfn)
 {
     conf_section *sec = ts? ts->sec: NULL;
+    tcarena_t *oa = tcarena_use(sec? sec->arena: tcarena_current);
+
     pthread_mutex_lock(&flex_mut);
     sec = tcc_lex(data, rfn, sec);
     pthread_mutex_unlock(&flex_mut);
 
-    if(!ts && sec)
-	ts = tcallocdz(sizeof(*ts), NULL, tcconf_free);
+    if(!ts && sec){
+	ts = tca_allocd(tcarena_current, sizeof(*ts), NULL, tcconf_free);
+	ts->parent = NULL;
+    }
     if(ts && sec)
 	ts->sec = sec;
+    tcarena_use(oa);
 
     return sec? ts: NULL;
 }
@@ -159,7 +167,7 @@ static conf_section *
 getsection(tcconf_section_t **ts, conf_section *sec, char *name)
 {
     tcconf_section_t *path = NULL;
-    char *tmp = strdup(name);
+    char *tmp = tcm_strdup(name);
     char *tn = tmp;
     char *s;
 
@@ -217,7 +225,7 @@ getsection(tcconf_section_t **ts, conf_section *sec, char *name)
 		break;
 
 	    if(path){
-		np = tcallocdz(sizeof(*np), NULL, tcconf_free);
+		np = tca_allocdz(NULL, sizeof(*np), NULL, tcconf_free);
 		np->sec = tcref(sec);
 		np->parent = path;
 		path = np;
@@ -229,7 +237,7 @@ getsection(tcconf_section_t **ts, conf_section *sec, char *name)
     if(ts)
 	*ts = path;
 /*     fprintf(stderr, "leave getsection\n"); */
-    free(tn);
+    tcm_free(tn);
     return sec;
 }
 
@@ -269,7 +277,7 @@ static tcc_entry *
 getvalue(conf_section *sec, char *name, tcconf_section_t **ts)
 {
     tcconf_section_t *path = NULL;
-    char *tmp = strdup(name);
+    char *tmp = tcm_strdup(name);
     char *v;
     tcc_entry *te = NULL;
 
@@ -307,7 +315,7 @@ getvalue(conf_section *sec, char *name, tcconf_section_t **ts)
 
 /*     fprintf(stderr, "leave getvalue\n"); */
 end:
-    free(tmp);
+    tcm_free(tmp);
     return te;
 }
 
@@ -598,14 +606,14 @@ vstate(tcconf_section_t *sec, char *name, void **state)
     v_state *vs = *state;
 
     if(!vs){
-	char *tmp = strdup(name);
+	char *tmp = tcm_strdup(name);
 	char *v = strrchr(tmp, '/');
 	tcconf_section_t *ms;
 
 	if(v){
 	    *v++ = 0;
 	    if(!(sec = tcconf_getsection(sec, tmp))){
-		free(tmp);
+		tcm_free(tmp);
 		return NULL;
 	    }
 	} else {
@@ -613,14 +621,14 @@ vstate(tcconf_section_t *sec, char *name, void **state)
 	    tcref(sec);
 	}
 
-	vs = *state = calloc(1, sizeof(v_state));
-	vs->n = strdup(v);
+	vs = *state = tcm_zalloc(sizeof(v_state));
+	vs->n = tcm_strdup(v);
 	vs->ts = sec;
 	ms = next_merge(sec, vs);
 	if(ms)
 	    sec = ms;
 	vs->sec = sec;
-	free(tmp);
+	tcm_free(tmp);
     }
 
     return vs;
@@ -629,9 +637,9 @@ vstate(tcconf_section_t *sec, char *name, void **state)
 static void
 vsfree(v_state *vs)
 {
-    free(vs->n);
+    tcm_free(vs->n);
     tcfree(vs->ts);
-    free(vs);
+    tcm_free(vs);
 }
 
 static int
@@ -747,7 +755,7 @@ tcconf_nextsection(tcconf_section_t *ts, char *name, void **state)
 	sec = te->section;
     }
 
-    ns = tcallocd(sizeof(*ns), NULL, tcconf_free);
+    ns = tca_allocd(NULL, sizeof(*ns), NULL, tcconf_free);
     ns->sec = tcref(sec);
     ns->parent = tcref(ts);
     return ns;
@@ -760,6 +768,8 @@ tcconf_merge(tcconf_section_t *sec, tcconf_section_t *s2)
     tcc_entry *te;
     char *m;
 
+    tcarena_t *oa;
+
     if(!sec){
 	sec = tcconf_new(NULL);
 	if(s2->parent)
@@ -769,11 +779,13 @@ tcconf_merge(tcconf_section_t *sec, tcconf_section_t *s2)
 	sec->sec->parent = s2->sec->parent;
     }
 
+    oa = tcarena_use(sec->sec->arena);
     while((te = tclist_next(s2->sec->entries, &li)))
 	tclist_push(sec->sec->entries, tcref(te));
 
     while((m = tclist_next(s2->sec->merge, &li)))
-	tclist_push(sec->sec->merge, strdup(m));
+	tclist_push(sec->sec->merge, tcc_strdup(m));
+    tcarena_use(oa);
 
     return sec;
 }
@@ -787,7 +799,7 @@ free_value(void *p)
     case TCC_REF:
 	free(tv->value.string);
     }
-    free(tv);
+    tcm_free(tv);
 }
 
 static void
@@ -797,6 +809,10 @@ free_entry(void *p)
 
     switch(te->type){
     case TCC_VALUE: 
+	if(te->arena){
+	    tclist_destroy(te->value.values, NULL);
+	    break;
+	}
 	tclist_destroy(te->value.values, free_value);
 	free(te->value.key);
 	break;
@@ -813,17 +829,20 @@ conf_free(void *p)
 {
     conf_section *sec = p;
     tclist_destroy(sec->entries, tcfree);
-    tclist_destroy(sec->merge, free);
-    if(sec->name)
+    tclist_destroy(sec->merge, sec->arena? NULL: free);
+    if(sec->name && !sec->arena)
 	free(sec->name);
 }
 
 extern conf_section *
 conf_new(char *name)
 {
+    tcarena_t *a = tcarena_current;
     conf_section *sec;
-    sec = tcallocdz(sizeof(*sec), NULL, conf_free);
-    sec->name = name? strdup(name): NULL;
+    sec = tca_allocd(a, sizeof(*sec), NULL, conf_free);
+    memset(sec, 0, sizeof(*sec));
+    sec->arena = a;
+    sec->name = name? tcc_strdup(name): NULL;
     sec->entries = tclist_new(TC_LOCK_SLOPPY);
     sec->merge = tclist_new(TC_LOCK_SLOPPY);
     return sec;
@@ -832,7 +851,9 @@ conf_new(char *name)
 extern tcconf_section_t *
 tcconf_new(char *name)
 {
-    tcconf_section_t *ts = tcallocdz(sizeof(*ts), NULL, tcconf_free);
+    tcconf_section_t *ts = tca_allocd(tcarena_current, sizeof(*ts), NULL,
+				      tcconf_free);
+    ts->parent = NULL;
     ts->sec = conf_new(name);
     return ts;
 }
@@ -841,7 +862,8 @@ static tcc_entry *
 alloc_entry(conf_section *sec, char *name, int type)
 {
     tcc_entry *te = NULL;
-    te = tcallocd(sizeof(*te), NULL, free_entry);
+    te = tca_allocd(tcarena_current, sizeof(*te), NULL, free_entry);
+    te->arena = tcarena_current;
     switch((te->type = type)){
     case TCC_SECTION:
     case TCC_MSECTION:
@@ -849,7 +871,7 @@ alloc_entry(conf_section *sec, char *name, int type)
 	te->section->parent = sec;
 	break;
     case TCC_VALUE:
-	te->value.key = strdup(name);
+	te->value.key = tcc_strdup(name);
 	te->value.values = tclist_new(TC_LOCK_SLOPPY);
 	break;
     }
@@ -859,7 +881,7 @@ alloc_entry(conf_section *sec, char *name, int type)
 extern tcc_entry *
 create_entry(conf_section *sec, char *name, int type)
 {
-    char *tmp = strdup(name);
+    char *tmp = tcm_strdup(name);
     char *tmpf = tmp;
     char *s, *v;
     tcc_entry *te;
@@ -906,7 +928,7 @@ create_entry(conf_section *sec, char *name, int type)
 	tclist_unshift(sec->entries, te);
     }
 
-    free(tmpf);
+    tcm_free(tmpf);
     return te;
 }
 
@@ -914,11 +936,13 @@ extern int
 tcconf_setvalue(tcconf_section_t *ts, char *name, char *fmt, ...)
 {
     conf_section *sec = ts->sec;
+    tcarena_t *oa = tcarena_use(sec->arena);
     tcc_entry *te;
     va_list args;
     char *f = fmt;
 
     te = create_entry(sec, name, TCC_VALUE);
+    tcarena_use(te->arena);
 
     va_start(args, fmt);
     while((f = strchr(f, '%')) != NULL){
@@ -940,11 +964,13 @@ tcconf_setvalue(tcconf_section_t *ts, char *name, char *fmt, ...)
 	    break;
 
 	case 's':
-	    tcc_addstring(te, strdup(va_arg(args, char *)), 0);
+	    tcc_addstring(te, tcc_strdup(va_arg(args, char *)), 0);
 	    break;
 	}
     }
+    va_end(args);
 
+    tcarena_use(oa);
     return 0;
 }
 
@@ -952,7 +978,7 @@ extern int
 tcconf_clearvalue(tcconf_section_t *ts, char *name)
 {
     conf_section *sec = NULL;
-    char *n = strdup(name);
+    char *n = tcm_strdup(name);
     char *p = strrchr(n, '/');
     tcconf_section_t *s = NULL;
     int c = 0;
@@ -971,18 +997,34 @@ tcconf_clearvalue(tcconf_section_t *ts, char *name)
     if(s)
 	tcfree(s);
 
-    free(n);
+    tcm_free(n);
     return c;
 }
 
 
 /* Internal functions */
 
+/* Copy a string into the current arena, or with strdup. */
+extern char *
+tcc_strdup(const char *s)
+{
+    size_t l;
+    char *d;
+
+    if(!tcarena_current)
+	return strdup(s);
+
+    l = strlen(s) + 1;
+    if((d = tcarena_alloc(tcarena_current, l)))
+	memcpy(d, s, l);
+    return d;
+}
+
 extern int
 tcc_addint(tcc_entry *te, long long n)
 {
     if(te->type == TCC_VALUE){
-	tcc_value *tv = malloc(sizeof(tcc_value));
+	tcc_value *tv = tca_alloc(te->arena, sizeof(tcc_value));
 	tv->type = TCC_INTEGER;
 	tv->value.integer = n;
 	tclist_push(te->value.values, tv);
@@ -994,7 +1036,7 @@ extern int
 tcc_addfloat(tcc_entry *te, double f)
 {
     if(te->type == TCC_VALUE){
-	tcc_value *tv = malloc(sizeof(tcc_value));
+	tcc_value *tv = tca_alloc(te->arena, sizeof(tcc_value));
 	tv->type = TCC_FLOAT;
 	tv->value.floating = f;
 	tclist_push(te->value.values, tv);
@@ -1006,7 +1048,7 @@ extern int
 tcc_addstring(tcc_entry *te, char *s, int exp)
 {
     if(te->type == TCC_VALUE){
-	tcc_value *tv = malloc(sizeof(tcc_value));
+	tcc_value *tv = tca_alloc(te->arena, sizeof(tcc_value));
 	tv->type = TCC_STRING;
 	if(exp)
 	    tv->type |= TCC_EXPAND;
@@ -1020,7 +1062,7 @@ extern int
 tcc_addbool(tcc_entry *te, int n)
 {
     if(te->type == TCC_VALUE){
-	tcc_value *tv = malloc(sizeof(tcc_value));
+	tcc_value *tv = tca_alloc(te->arena, sizeof(tcc_value));
 	tv->type = TCC_BOOLEAN;
 	tv->value.boolean = n;
 	tclist_push(te->value.values, tv);
@@ -1032,7 +1074,7 @@ extern int
 tcc_addref(tcc_entry *te, char *ref)
 {
     if(te->type == TCC_VALUE){
-	tcc_value *tv = malloc(sizeof(*tv));
+	tcc_value *tv = tca_alloc(te->arena, sizeof(*tv));
 	tv->type = TCC_REF;
 	tv->value.string = ref;
 	tclist_push(te->value.values, tv);
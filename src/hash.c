@@ -31,6 +31,9 @@
 #include <tcalloc.h>
 #include <tc.h>
 
+#define TCM_SUBSYS TCPROF_HASH
+#include "tcm-internal.h"
+
 /* Structure for each entry in table. */
 typedef struct hash_entry {
     void *key;
@@ -49,6 +52,7 @@ struct tchash_table {
     pthread_mutex_t lock;
     float high_mark, low_mark;
     tcmempool_t *mp;
+    tcarena_t *arena;
 };
 
 static u_int
@@ -186,20 +190,22 @@ hash_value(tchash_table_t *ht, void *key, size_t ks, size_t size)
 extern tchash_table_t *
 tchash_new(int size, int lock, uint32_t flags)
 {
+    tcarena_t *a = tcarena_current;
     tchash_table_t *ht;
 
     size = hash_size(size);
-    ht = malloc(sizeof(*ht));
+    ht = tca_alloc(a, sizeof(*ht));
+    ht->arena = a;
     ht->size = size;
     ht->entries = 0;
     ht->flags = flags;
-    ht->buckets = calloc(size, sizeof(*ht->buckets));
+    ht->buckets = tca_zalloc(a, size * sizeof(*ht->buckets));
     ht->locking = lock;
     pthread_mutex_init(&ht->lock, NULL);
     ht->high_mark = 0.7;
     ht->low_mark = 0.3;
     ht->hash_func = hash_func;
-    ht->mp = tcmempool_new(sizeof(hash_entry), 0);
+    ht->mp = a? NULL: tcmempool_new(sizeof(hash_entry), 0);
 
     return ht;
 }
@@ -248,11 +254,14 @@ hash_kdup(void *key, size_t ks)
 static inline hash_entry *
 hash_addentry(tchash_table_t *ht, u_int hv, void *key, size_t ks, void *data)
 {
-    hash_entry *he = tcmempool_get(ht->mp);
+    hash_entry *he = ht->mp? tcm_poolget(ht->mp, sizeof(*he)):
+	tcarena_alloc(ht->arena, sizeof(*he));
     if(ht->flags & TCHASH_NOCOPY)
 	he->key = key;
-    else
-	he->key = hash_kdup(key, ks);
+    else {
+	he->key = tca_alloc(ht->arena, ks);
+	memcpy(he->key, key, ks);
+    }
     he->key_size = ks;
     he->data = data;
     he->next = ht->buckets[hv];
@@ -262,6 +271,15 @@ hash_addentry(tchash_table_t *ht, u_int hv, void *key, size_t ks, void *data)
     return he;
 }
 
+static inline void
+hash_freeentry(tchash_table_t *ht, hash_entry *he)
+{
+    if(!(ht->flags & TCHASH_NOCOPY))
+	tca_free(ht->arena, he->key);
+    if(ht->mp)
+	tcm_poolfree(he);
+}
+
 /* Find or add to table. */
 extern int
 tchash_search(tchash_table_t *ht, void *key, size_t ks, void *data, void *r)
@@ -389,9 +407,7 @@ tchash_delete(tchash_table_t *ht, void *key, size_t ks, void *r)
 	else
 	    ht->buckets[hv] = hr->next;
 	ht->entries--;
-	if(!(ht->flags & TCHASH_NOCOPY))
-	    free(hr->key);
-	tcmempool_free(hr);
+	hash_freeentry(ht, hr);
     }
 
     unlock_hash(ht);
@@ -405,26 +421,24 @@ tchash_delete(tchash_table_t *ht, void *key, size_t ks, void *r)
 extern int
 tchash_destroy(tchash_table_t *ht, tcfree_fn hf)
 {
-    size_t i;
-    for(i = 0; i < ht->size; i++){
+    size_t i, n = ht->arena && !hf? 0: ht->size;
+    for(i = 0; i < n; i++){
 	if(ht->buckets[i] != NULL){
 	    hash_entry *he = ht->buckets[i];
 	    while(he){
 		hash_entry *hn = he->next;
 		if(hf)
 		    hf(he->data);
-		if(!(ht->flags & TCHASH_NOCOPY))
-		    free(he->key);
-		tcmempool_free(he);
+		hash_freeentry(ht, he);
 		he = hn;
 	    }
 	}
     }
 
-    free(ht->buckets);
+    tca_free(ht->arena, ht->buckets);
     pthread_mutex_destroy(&ht->lock);
     tcfree(ht->mp);
-    free(ht);
+    tca_free(ht->arena, ht);
 
     return 0;
 }
@@ -440,7 +454,7 @@ tchash_rehash(tchash_table_t *ht)
     ns = hash_size(ht->entries * 2 / (ht->high_mark + ht->low_mark));
     if(ns == ht->size)
 	goto end;
-    nb = calloc(ns, sizeof(*nb));
+    nb = tca_zalloc(ht->arena, ns * sizeof(*nb));
 
     for(i = 0; i < ht->size; i++){
 	hash_entry *he = ht->buckets[i];
@@ -454,7 +468,7 @@ tchash_rehash(tchash_table_t *ht)
     }
 
     ht->size = ns;
-    free(ht->buckets);
+    tca_free(ht->arena, ht->buckets);
     ht->buckets = nb;
 
 end:
@@ -27,6 +27,9 @@
 #include <pthread.h>
 #include "tclist.h"
 
+#define TCM_SUBSYS TCPROF_LIST
+#include "tcm-internal.h"
+
 struct tclist_item {
     void *data;
     tclist_item_t *next;
@@ -42,12 +45,15 @@ struct tclist {
     unsigned long items, deleted;
     int locking;
     pthread_mutex_t lock;
+    tcarena_t *arena;
 };
 
 extern tclist_t *
 tclist_new(int locking)
 {
-    tclist_t *l = calloc(1, sizeof(*l));
+    tcarena_t *a = tcarena_current;
+    tclist_t *l = tca_zalloc(a, sizeof(*l));
+    l->arena = a;
     l->locking = locking;
     if(locking > TC_LOCK_NONE)
 	pthread_mutex_init(&l->lock, NULL);
@@ -63,7 +69,7 @@ tclist_free(tclist_t *lst)
     if(lst->locking > TC_LOCK_NONE)
 	pthread_mutex_destroy(&lst->lock);
 
-    free(lst);
+    tca_free(lst->arena, lst);
     return 0;
 }
 
@@ -85,7 +91,7 @@ list_unlink(tclist_t *lst, tclist_item_t *l)
     lst->items--;
     if(l->deleted)
 	lst->deleted--;
-    free(l);
+    tca_free(lst->arena, l);
 }
 
 static inline void
@@ -143,6 +149,8 @@ extern int
 tclist_destroy(tclist_t *lst, tcfree_fn lfree)
 {
     lock_list(lst);
+    if(lst->arena && !lfree)
+	lst->start = NULL;
     while(lst->start){
 	lst->start->free = lfree;
 	list_unlink(lst, lst->start);
@@ -153,9 +161,9 @@ tclist_destroy(tclist_t *lst, tcfree_fn lfree)
 }
 
 static tclist_item_t *
-new_item(void *p)
+new_item(tclist_t *lst, void *p)
 {
-    tclist_item_t *l = malloc(sizeof(tclist_item_t));
+    tclist_item_t *l = tca_alloc(lst->arena, sizeof(tclist_item_t));
     l->data = p;
     l->rc = 1;
     l->ic = 0;
@@ -167,7 +175,7 @@ new_item(void *p)
 extern int
 tclist_push(tclist_t *lst, void *p)
 {
-    tclist_item_t *l = new_item(p);
+    tclist_item_t *l = new_item(lst, p);
 
     lock_list(lst);
     if(lst->start == NULL){
@@ -189,7 +197,7 @@ tclist_push(tclist_t *lst, void *p)
 extern int
 tclist_unshift(tclist_t *lst, void *p)
 {
-    tclist_item_t *l = new_item(p);
+    tclist_item_t *l = new_item(lst, p);
 
     lock_list(lst);
     if(lst->start == NULL){
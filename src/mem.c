@@ -0,0 +1,208 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * General allocator with size classes.  Requests up to 32k are rounded
+ * up to one of 41 classes, 8, 16 to 128 in steps of 16, and then four
+ * per power of two, so at most a fifth is wasted.  Each class has its
+ * own memory pool with per-thread magazines, created on first use.
+ * Larger requests go to malloc.  Chunks from the pools are told from
+ * malloc blocks by the pool page map, so tcmem_free and tcmem_realloc
+ * also accept memory from malloc.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <tcmem.h>
+#include <tcmempool.h>
+
+#define TCM_SUBSYS TCPROF_MEM
+#include "tcm-internal.h"
+
+#define TCMEM_MAX (32 << 10)
+#define TCMEM_CLASSES 41
+
+/* Classes up to this size get 64k slabs, rather than a page or two,
+ * to map and unmap slabs less often. */
+#define TCMEM_BIGSLAB 1024
+
+int tcmem_active;
+
+static tcmempool_t *classes[TCMEM_CLASSES];
+static pthread_mutex_t class_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int
+size_class(size_t n, size_t *size)
+{
+    int k, m;
+
+    if(n <= 8){
+	*size = 8;
+	return 0;
+    }
+
+    if(n <= 128){
+	*size = (n + 15) & ~15;
+	return (n + 15) >> 4;
+    }
+
+    k = 63 - __builtin_clzll(n - 1);
+    m = (n + ((size_t) 1 << (k - 2)) - 1) >> (k - 2);
+    *size = (size_t) m << (k - 2);
+    return 9 + (k - 7) * 4 + m - 5;
+}
+
+static tcmempool_t *
+class_pool(int c, size_t size)
+{
+    tcmempool_t *mp = __atomic_load_n(&classes[c], __ATOMIC_ACQUIRE);
+
+    if(mp)
+	return mp;
+
+    pthread_mutex_lock(&class_lock);
+    if(!(mp = classes[c])){
+	mp = tcmempool_newf(size, 1, TCMEMPOOL_MAGAZINES |
+			    (size <= TCMEM_BIGSLAB? TCMEMPOOL_SLAB(16): 0));
+	__atomic_store_n(&classes[c], mp, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&class_lock);
+
+    return mp;
+}
+
+/* The mem_ functions are for libtc's own use and not reported to
+ * allocation observers. */
+
+extern void *
+mem_alloc(size_t size)
+{
+    tcmempool_t *mp;
+    size_t cs;
+    int c;
+
+    if(size > TCMEM_MAX)
+	return malloc(size);
+
+    c = size_class(size, &cs);
+    if(!(mp = class_pool(c, cs)))
+	return NULL;
+
+    return mempool_get(mp);
+}
+
+extern void *
+mem_zalloc(size_t size)
+{
+    void *p;
+
+    if(size > TCMEM_MAX)
+	return calloc(1, size);
+
+    if((p = mem_alloc(size)))
+	memset(p, 0, size);
+
+    return p;
+}
+
+extern void
+mem_free(void *p)
+{
+    if(p && !mempool_release(p))
+	free(p);
+}
+
+extern void *
+mem_realloc(void *p, size_t size)
+{
+    size_t os, ns;
+    void *q;
+
+    if(!p)
+	return mem_alloc(size);
+
+    if(!(os = tcmempool_chunksize(p)))
+	return realloc(p, size);
+
+    if(size <= TCMEM_MAX){
+	size_class(size, &ns);
+	if(ns == os)
+	    return p;
+    }
+
+    if(!(q = mem_alloc(size)))
+	return NULL;
+    memcpy(q, p, os < size? os: size);
+    mempool_release(p);
+
+    return q;
+}
+
+extern void *
+tcmem_alloc(size_t size)
+{
+    return tcp_alloc(mem_alloc(size), size, TCPROF_MEM, __func__);
+}
+
+extern void *
+tcmem_zalloc(size_t size)
+{
+    return tcp_alloc(mem_zalloc(size), size, TCPROF_MEM, __func__);
+}
+
+extern void
+tcmem_free(void *p)
+{
+    tcp_free(p);
+    mem_free(p);
+}
+
+extern void *
+tcmem_realloc(void *p, size_t size)
+{
+    void *q = mem_realloc(p, size);
+
+    if(q)
+	tcp_free(p);
+    return tcp_alloc(q, size, TCPROF_MEM, __func__);
+}
+
+extern char *
+tcmem_strdup(const char *s)
+{
+    size_t l = strlen(s) + 1;
+    char *d = mem_alloc(l);
+
+    if(d)
+	memcpy(d, s, l);
+
+    return tcp_alloc(d, l, TCPROF_MEM, __func__);
+}
+
+extern void
+tcmem_use(int on)
+{
+    tcmem_active = on;
+}
@@ -22,6 +22,7 @@
     DEALINGS IN THE SOFTWARE.
 **/
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -31,17 +32,25 @@
 #include <stddef.h>
 #include <tcalloc.h>
 #include <tcmempool.h>
+
+#define TCM_SUBSYS TCPROF_MEMPOOL
+#include "tcm-internal.h"
 #include <tc.h>
 
 #ifndef MAP_ANONYMOUS
 #define MAP_ANONYMOUS MAP_ANON
 #endif
 
+#define HUGE_SIZE (2 << 20)
+#define MAX_CHUNK (1 << 20)
+
 typedef struct tcmempool_page {
     tcmempool_t *pool;
     size_t used, inuse;
     void *free;
+    void **owner;
     struct tcmempool_page *next, *prev;
+    struct tcmempool_page *anext, *aprev;
     union {
 	long l;
 	double d;
@@ -49,23 +58,221 @@ typedef struct tcmempool_page {
     } data[1];
 } tcmempool_page_t;
 
+/*
+ * With TCMEMPOOL_MAGAZINES, each thread keeps a magazine of free
+ * chunks, found through a thread-specific key of the pool.  Chunks are
+ * taken from and freed to the magazine without locking.  An empty
+ * magazine is refilled, and a full one half emptied, in one batch under
+ * the pool lock.  Magazines are returned to the pool when their thread
+ * exits, and freed with the pool.
+ */
+
+#define MAG_SIZE 64
+
+typedef struct tcmempool_mag {
+    tcmempool_t *pool;
+    int n;
+    struct tcmempool_mag *next, *prev;
+    void *chunks[MAG_SIZE];
+} tcmempool_mag_t;
+
 struct tcmempool {
     size_t size;
     size_t cpp;
     tcmempool_page_t *pages;
+    tcmempool_page_t *all;
     int locking;
     pthread_mutex_t lock;
+    int magazines;
+    pthread_key_t key;
+    tcmempool_mag_t *mags;
+    size_t slab;
+    int huge;
+    int retain, nempty;
+    int debug;
+    unsigned long out, peak;
+    unsigned long maps, unmaps, lockwaits;
 };
 
+/*
+ * With TCMEMPOOL_DEBUG, free chunks are filled with POISON, except for
+ * the free list link, and checked when handed out again.  Each slab
+ * has an owner array holding the caller of tcmempool_get for each live
+ * chunk, or NULL for a free one, which catches double and bad frees.
+ */
+
+#define POISON 0xdb
+
 static long pagesize;
 
+/*
+ * Slabs may be larger than a page, and are not aligned, so chunks are
+ * mapped to their slab through a radix tree indexed by the address of
+ * each 4k page.  Three levels of 4096 entries cover 48 bits.  Interior
+ * nodes are never freed, so lookups need no lock.
+ */
+
+#define PM_SHIFT 12
+#define PM_BITS  12
+#define PM_SIZE  (1 << PM_BITS)
+
+typedef struct pm_leaf {
+    tcmempool_page_t *page[PM_SIZE];
+} pm_leaf_t;
+
+typedef struct pm_mid {
+    pm_leaf_t *leaf[PM_SIZE];
+} pm_mid_t;
+
+static pm_mid_t *pm_root[PM_SIZE];
+static pthread_mutex_t pm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+pm_set(void *p, size_t len, tcmempool_page_t *mpp)
+{
+    uintptr_t k = (uintptr_t) p >> PM_SHIFT;
+    uintptr_t e = k + (len >> PM_SHIFT);
+    int rt = 0;
+
+    if(e > (uintptr_t) 1 << 3 * PM_BITS)
+	return -1;
+
+    pthread_mutex_lock(&pm_lock);
+
+    for(; k < e; k++){
+	pm_mid_t *m = pm_root[k >> 2 * PM_BITS];
+	pm_leaf_t *l;
+
+	if(!m){
+	    if(!(m = calloc(1, sizeof(*m)))){
+		rt = -1;
+		break;
+	    }
+	    __atomic_store_n(&pm_root[k >> 2 * PM_BITS], m, __ATOMIC_RELEASE);
+	}
+
+	l = m->leaf[(k >> PM_BITS) & (PM_SIZE - 1)];
+	if(!l){
+	    if(!(l = calloc(1, sizeof(*l)))){
+		rt = -1;
+		break;
+	    }
+	    __atomic_store_n(&m->leaf[(k >> PM_BITS) & (PM_SIZE - 1)], l,
+			     __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&l->page[k & (PM_SIZE - 1)], mpp, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&pm_lock);
+    return rt;
+}
+
+static inline tcmempool_page_t *
+pm_get(void *p)
+{
+    uintptr_t k = (uintptr_t) p >> PM_SHIFT;
+    pm_mid_t *m = __atomic_load_n(&pm_root[k >> 2 * PM_BITS],
+				  __ATOMIC_ACQUIRE);
+    pm_leaf_t *l = __atomic_load_n(&m->leaf[(k >> PM_BITS) & (PM_SIZE - 1)],
+				   __ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&l->page[k & (PM_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+/* Like pm_get, for pointers that may not be in any slab. */
+static tcmempool_page_t *
+pm_find(const void *p)
+{
+    uintptr_t k = (uintptr_t) p >> PM_SHIFT;
+    pm_mid_t *m;
+    pm_leaf_t *l;
+
+    if(k >> 3 * PM_BITS)
+	return NULL;
+    if(!(m = __atomic_load_n(&pm_root[k >> 2 * PM_BITS], __ATOMIC_ACQUIRE)))
+	return NULL;
+    if(!(l = __atomic_load_n(&m->leaf[(k >> PM_BITS) & (PM_SIZE - 1)],
+			     __ATOMIC_ACQUIRE)))
+	return NULL;
+
+    return __atomic_load_n(&l->page[k & (PM_SIZE - 1)], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Map a slab.  Huge pages are tried first if asked for, else
+ * transparent huge pages are requested for an aligned slab.
+ */
+
+static tcmempool_page_t *
+slab_map(tcmempool_t *mp)
+{
+    void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if(mp->huge)
+	p = mmap(NULL, mp->slab, PROT_READ | PROT_WRITE,
+		 MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+#endif
+
+    if(p == MAP_FAILED && mp->huge){
+	char *a = mmap(NULL, 2 * mp->slab, PROT_READ | PROT_WRITE,
+		       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if(a != MAP_FAILED){
+	    size_t off = -(uintptr_t) a & (mp->slab - 1);
+	    if(off)
+		munmap(a, off);
+	    munmap(a + off + mp->slab, mp->slab - off);
+	    p = a + off;
+#ifdef MADV_HUGEPAGE
+	    madvise(p, mp->slab, MADV_HUGEPAGE);
+#endif
+	}
+    } else if(p == MAP_FAILED){
+	p = mmap(NULL, mp->slab, PROT_READ | PROT_WRITE,
+		 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    }
+
+    if(p == MAP_FAILED)
+	return NULL;
+
+    if(pm_set(p, mp->slab, p)){
+	munmap(p, mp->slab);
+	return NULL;
+    }
+
+    if(mp->debug){
+	tcmempool_page_t *mpp = p;
+	if(!(mpp->owner = calloc(mp->cpp, sizeof(*mpp->owner)))){
+	    pm_set(p, mp->slab, NULL);
+	    munmap(p, mp->slab);
+	    return NULL;
+	}
+	memset(mpp->data, POISON, mp->cpp * mp->size);
+    }
+
+    mp->maps++;
+    return p;
+}
+
+static void
+slab_unmap(tcmempool_t *mp, tcmempool_page_t *mpp)
+{
+    free(mpp->owner);
+    pm_set(mpp, mp->slab, NULL);
+    munmap(mpp, mp->slab);
+    mp->unmaps++;
+}
+
 #define align(s,a) (((s)+(a)-1) & ~((a)-1))
 
 static inline void
 mp_lock(tcmempool_t *mp)
 {
-    if(mp->locking)
+    if(mp->locking && pthread_mutex_trylock(&mp->lock)){
 	pthread_mutex_lock(&mp->lock);
+	mp->lockwaits++;
+    }
 }
 
 static inline void
@@ -76,50 +283,95 @@ mp_unlock(tcmempool_t *mp)
 }
 
 static void
-mp_free(void *p)
+mp_abort(const char *what, void *p)
 {
-    tcmempool_t *mp = p;
-    pthread_mutex_destroy(&mp->lock);
+    fprintf(stderr, "tcmempool: %s %p\n", what, p);
+    abort();
 }
 
-extern tcmempool_t *
-tcmempool_new(size_t size, int lock)
+static inline size_t
+chunk_index(tcmempool_t *mp, tcmempool_page_t *mpp, void *p)
 {
-    tcmempool_t *mp;
+    size_t off = (char *) p - (char *) mpp->data;
 
-    if(!pagesize)
-	pagesize = sysconf(_SC_PAGESIZE);
+    if(off % mp->size || off / mp->size >= mpp->used)
+	mp_abort("free of invalid pointer", p);
 
-    size = align(size, sizeof(void *));
-    if(size > pagesize - offsetof(tcmempool_page_t, data))
-	return NULL;
+    return off / mp->size;
+}
 
-    mp = tcallocdz(sizeof(*mp), NULL, mp_free);
-    mp->size = size;
-    mp->cpp = (pagesize - offsetof(tcmempool_page_t, data)) / size;
-    mp->locking = lock;
-    pthread_mutex_init(&mp->lock, NULL);
+static void
+debug_get(tcmempool_t *mp, void *p, void *caller)
+{
+    tcmempool_page_t *mpp = pm_get(p);
+    unsigned char *c = p;
+    size_t i;
 
-    return mp;
+    for(i = sizeof(void *); i < mp->size; i++)
+	if(c[i] != POISON)
+	    mp_abort("chunk modified after free", p);
+
+    mpp->owner[chunk_index(mp, mpp, p)] = caller? caller: p;
 }
 
-extern void *
-tcmempool_get(tcmempool_t *mp)
+static void
+debug_free(tcmempool_t *mp, tcmempool_page_t *mpp, void *p)
+{
+    size_t i = chunk_index(mp, mpp, p);
+
+    if(!mpp->owner[i])
+	mp_abort("double free of", p);
+
+    mpp->owner[i] = NULL;
+    memset(p, POISON, mp->size);
+}
+
+/* Release all pages, including any chunks still in use. */
+static void
+mp_free(void *p)
+{
+    tcmempool_t *mp = p;
+    tcmempool_page_t *mpp, *n;
+    tcmempool_mag_t *mag, *nm;
+
+    if(mp->magazines){
+	pthread_key_delete(mp->key);
+	for(mag = mp->mags; mag; mag = nm){
+	    nm = mag->next;
+	    free(mag);
+	}
+    }
+
+    for(mpp = mp->all; mpp; mpp = n){
+	n = mpp->anext;
+	slab_unmap(mp, mpp);
+    }
+
+    pthread_mutex_destroy(&mp->lock);
+}
+
+static void *
+mp_get(tcmempool_t *mp)
 {
     tcmempool_page_t *mpp;
     void *chunk;
 
-    mp_lock(mp);
-
     mpp = mp->pages;
 
     if(!mpp){
-	mpp = mmap(NULL, pagesize, PROT_READ | PROT_WRITE,
-		   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if(!(mpp = slab_map(mp)))
+	    return NULL;
 	mpp->pool = mp;
 	mp->pages = mpp;
+	if(mp->all)
+	    mp->all->aprev = mpp;
+	mpp->anext = mp->all;
+	mp->all = mpp;
     }
 
+    if(!mpp->inuse && mpp->used)
+	mp->nempty--;
+
     if(mpp->free){
 	chunk = mpp->free;
 	mpp->free = *(void **) chunk;
@@ -130,41 +382,424 @@ tcmempool_get(tcmempool_t *mp)
 
     if(++mpp->inuse == mp->cpp){
 	mp->pages = mpp->next;
+	if(mp->pages)
+	    mp->pages->prev = NULL;
 	mpp->next = NULL;
 	mpp->prev = NULL;
     }
 
+    if(++mp->out > mp->peak)
+	mp->peak = mp->out;
+
+    return chunk;
+}
+
+static void
+slab_release(tcmempool_t *mp, tcmempool_page_t *mpp)
+{
+    if(mp->pages == mpp)
+	mp->pages = mpp->next;
+    if(mpp->next)
+	mpp->next->prev = mpp->prev;
+    if(mpp->prev)
+	mpp->prev->next = mpp->next;
+    if(mp->all == mpp)
+	mp->all = mpp->anext;
+    if(mpp->anext)
+	mpp->anext->aprev = mpp->aprev;
+    if(mpp->aprev)
+	mpp->aprev->anext = mpp->anext;
+    slab_unmap(mp, mpp);
+}
+
+/* Empty slabs are kept for reuse, up to the retain count. */
+static void
+mp_put(tcmempool_t *mp, void *p)
+{
+    tcmempool_page_t *mpp = pm_get(p);
+
+    mp->out--;
+    if(!--mpp->inuse){
+	if(mp->nempty >= mp->retain){
+	    slab_release(mp, mpp);
+	    return;
+	}
+	mp->nempty++;
+    }
+
+    *(void **) p = mpp->free;
+    mpp->free = p;
+    if(!mpp->next && !mpp->prev && mp->pages != mpp){
+	if(mp->pages)
+	    mp->pages->prev = mpp;
+	mpp->next = mp->pages;
+	mp->pages = mpp;
+    }
+}
+
+/* Thread exit: give the chunks back and drop the magazine. */
+static void
+mag_release(void *p)
+{
+    tcmempool_mag_t *mag = p;
+    tcmempool_t *mp = mag->pool;
+
+    mp_lock(mp);
+    while(mag->n)
+	mp_put(mp, mag->chunks[--mag->n]);
+    if(mag->next)
+	mag->next->prev = mag->prev;
+    if(mag->prev)
+	mag->prev->next = mag->next;
+    else
+	mp->mags = mag->next;
+    mp_unlock(mp);
+
+    free(mag);
+}
+
+static tcmempool_mag_t *
+mag_get(tcmempool_t *mp)
+{
+    tcmempool_mag_t *mag = pthread_getspecific(mp->key);
+
+    if(mag)
+	return mag;
+
+    if(!(mag = malloc(sizeof(*mag))))
+	return NULL;
+    mag->pool = mp;
+    mag->n = 0;
+    mag->prev = NULL;
+
+    mp_lock(mp);
+    mag->next = mp->mags;
+    if(mp->mags)
+	mp->mags->prev = mag;
+    mp->mags = mag;
+    mp_unlock(mp);
+
+    pthread_setspecific(mp->key, mag);
+    return mag;
+}
+
+static void *
+mag_alloc(tcmempool_t *mp)
+{
+    tcmempool_mag_t *mag = mag_get(mp);
+    void *chunk;
+
+    if(!mag){
+	mp_lock(mp);
+	chunk = mp_get(mp);
+	mp_unlock(mp);
+	return chunk;
+    }
+
+    if(!mag->n){
+	mp_lock(mp);
+	while(mag->n < MAG_SIZE / 2 && (chunk = mp_get(mp)))
+	    mag->chunks[mag->n++] = chunk;
+	mp_unlock(mp);
+	if(!mag->n)
+	    return NULL;
+    }
+
+    return mag->chunks[--mag->n];
+}
+
+static void
+mag_free(tcmempool_t *mp, void *p)
+{
+    tcmempool_mag_t *mag = mag_get(mp);
+
+    if(!mag){
+	mp_lock(mp);
+	mp_put(mp, p);
+	mp_unlock(mp);
+	return;
+    }
+
+    if(mag->n == MAG_SIZE){
+	mp_lock(mp);
+	while(mag->n > MAG_SIZE / 2)
+	    mp_put(mp, mag->chunks[--mag->n]);
+	mp_unlock(mp);
+    }
+
+    mag->chunks[mag->n++] = p;
+}
+
+/*
+ * Choose a slab size, in whole pages, for chunks of size bytes.  A slab
+ * should hold at least 8 chunks, or 1 MiB of them for large chunks, and
+ * waste no more than an eighth of its size.
+ */
+
+static size_t
+slab_size(size_t size)
+{
+    size_t hdr = offsetof(tcmempool_page_t, data);
+    size_t n = size * 8 <= MAX_CHUNK? 8: MAX_CHUNK / size;
+    size_t slab;
+
+    if(!n)
+	n = 1;
+
+    slab = align(n * size + hdr, (size_t) pagesize);
+    while((slab - hdr) % size > slab / 8)
+	slab += pagesize;
+
+    return slab;
+}
+
+extern tcmempool_t *
+tcmempool_newf(size_t size, int lock, uint32_t flags)
+{
+    int shift = (flags & TCMEMPOOL_SLABMASK) >> 8;
+    size_t slab;
+    tcmempool_t *mp;
+
+    if(!pagesize)
+	pagesize = sysconf(_SC_PAGESIZE);
+
+    if(shift && (shift < 16 || shift > 21))
+	return NULL;
+
+    size = size? align(size, sizeof(void *)): sizeof(void *);
+    if(size > MAX_CHUNK)
+	return NULL;
+
+    if(shift){
+	slab = (size_t) 1 << shift;
+	if(slab < (size_t) pagesize)
+	    slab = pagesize;
+	if(size > slab - offsetof(tcmempool_page_t, data))
+	    return NULL;
+    } else {
+	slab = slab_size(size);
+    }
+
+    mp = tca_allocf(NULL, sizeof(*mp), NULL, mp_free,
+		    TCALLOC_ZERO | TCALLOC_MALLOC, TCM_SUBSYS, __func__);
+    mp->size = size;
+    mp->slab = slab;
+    mp->huge = (flags & TCMEMPOOL_HUGEPAGES) && slab == HUGE_SIZE;
+    mp->debug = !!(flags & TCMEMPOOL_DEBUG);
+    mp->retain = 1;
+    mp->cpp = (slab - offsetof(tcmempool_page_t, data)) / size;
+    mp->locking = lock;
+    pthread_mutex_init(&mp->lock, NULL);
+
+    if(lock && !mp->debug && (flags & TCMEMPOOL_MAGAZINES) &&
+       !pthread_key_create(&mp->key, mag_release))
+	mp->magazines = 1;
+
+    return mp;
+}
+
+extern tcmempool_t *
+tcmempool_new(size_t size, int lock)
+{
+    return tcmempool_newf(size, lock, 0);
+}
+
+extern void
+tcmempool_retain(tcmempool_t *mp, int slabs)
+{
+    tcmempool_page_t *mpp, *n;
+
+    mp_lock(mp);
+
+    mp->retain = slabs > 0? slabs: 0;
+    for(mpp = mp->pages; mpp && mp->nempty > mp->retain; mpp = n){
+	n = mpp->next;
+	if(!mpp->inuse && mpp->used){
+	    slab_release(mp, mpp);
+	    mp->nempty--;
+	}
+    }
+
+    mp_unlock(mp);
+}
+
+static inline void *
+mp_chunk(tcmempool_t *mp, void *caller)
+{
+    void *chunk;
+
+    if(mp->magazines)
+	return mag_alloc(mp);
+
+    mp_lock(mp);
+    chunk = mp_get(mp);
+    if(chunk && mp->debug)
+	debug_get(mp, chunk, caller);
     mp_unlock(mp);
 
     return chunk;
 }
 
+extern void *
+tcmempool_get(tcmempool_t *mp)
+{
+    return tcp_alloc(mp_chunk(mp, __builtin_return_address(0)), mp->size,
+		     TCPROF_MEMPOOL, __func__);
+}
+
+/* tcmempool_get for libtc's own pools, not reported. */
+extern void *
+mempool_get(tcmempool_t *mp)
+{
+    return mp_chunk(mp, __builtin_return_address(0));
+}
+
+static void
+mp_release(tcmempool_page_t *mpp, void *p)
+{
+    tcmempool_t *mp = mpp->pool;
+
+    if(mp->magazines){
+	mag_free(mp, p);
+	return;
+    }
+
+    mp_lock(mp);
+    if(mp->debug)
+	debug_free(mp, mpp, p);
+    mp_put(mp, p);
+    mp_unlock(mp);
+}
+
 extern void
 tcmempool_free(void *p)
 {
-    tcmempool_page_t *mpp = (void *) ((ptrdiff_t) p & ~(pagesize - 1));
-    tcmempool_t *mp = mpp->pool;
+    tcmempool_page_t *mpp = pm_find(p);
+
+    if(!mpp)
+	mp_abort("free of non-pool pointer", p);
+
+    tcp_free(p);
+    mp_release(mpp, p);
+}
+
+/*
+ * Free p if it is a pool chunk, for tcmem_free.  Returns the chunk size,
+ * or 0 if p belongs to no pool.
+ */
+
+extern size_t
+mempool_release(void *p)
+{
+    tcmempool_page_t *mpp = pm_find(p);
+    size_t size;
+
+    if(!mpp)
+	return 0;
+
+    size = mpp->pool->size;
+    mp_release(mpp, p);
+    return size;
+}
+
+extern size_t
+tcmempool_chunksize(const void *p)
+{
+    tcmempool_page_t *mpp = pm_find(p);
+
+    return mpp? mpp->pool->size: 0;
+}
+
+extern void
+tcmempool_stats(tcmempool_t *mp, tcmempool_stats_t *st)
+{
+    tcmempool_mag_t *mag;
 
     mp_lock(mp);
 
-    if(!--mpp->inuse){
-	if(mp->pages == mpp)
-	    mp->pages = mpp->next;
-	if(mpp->next)
-	    mpp->next->prev = mpp->prev;
-	if(mpp->prev)
-	    mpp->prev->next = mpp->next;
-	munmap(mpp, pagesize);
-    } else {
-	*(void **) p = mpp->free;
-	mpp->free = p;
-	if(!mpp->next && !mpp->prev && mp->pages != mpp){
-	    if(mp->pages)
-		mp->pages->prev = mpp;
-	    mpp->next = mp->pages;
-	    mp->pages = mpp;
+    st->size = mp->size;
+    st->slab = mp->slab;
+    st->slabs = mp->maps - mp->unmaps;
+    st->pages = st->slabs * (mp->slab / pagesize);
+    st->capacity = st->slabs * mp->cpp;
+    st->cached = 0;
+    for(mag = mp->mags; mag; mag = mag->next)
+	st->cached += __atomic_load_n(&mag->n, __ATOMIC_RELAXED);
+    st->inuse = mp->out - st->cached;
+    st->peak = mp->peak;
+    st->maps = mp->maps;
+    st->unmaps = mp->unmaps;
+    st->lockwaits = mp->lockwaits;
+
+    mp_unlock(mp);
+}
+
+/*
+ * Live chunks are those carved from a slab and not on its free list.
+ * Without TCMEMPOOL_DEBUG, this includes chunks cached in magazines.
+ */
+
+extern unsigned long
+tcmempool_walk(tcmempool_t *mp, tcmempool_walk_fn fn, void *data)
+{
+    tcmempool_page_t *mpp;
+    unsigned char *fr = NULL;
+    unsigned long n = 0;
+    size_t i;
+    void *c;
+
+    mp_lock(mp);
+
+    if(!mp->debug && mp->all && !(fr = malloc(mp->cpp))){
+	mp_unlock(mp);
+	return 0;
+    }
+
+    for(mpp = mp->all; mpp; mpp = mpp->anext){
+	if(!mp->debug){
+	    memset(fr, 0, mpp->used);
+	    for(c = mpp->free; c; c = *(void **) c)
+		fr[chunk_index(mp, mpp, c)] = 1;
+	}
+
+	for(i = 0; i < mpp->used; i++){
+	    if(mp->debug? !mpp->owner[i]: fr[i])
+		continue;
+	    c = (char *) mpp->data + i * mp->size;
+	    if(fn)
+		fn(c, mp->debug && mpp->owner[i] != c? mpp->owner[i]: NULL,
+		   data);
+	    n++;
 	}
     }
 
     mp_unlock(mp);
+    free(fr);
+
+    return n;
+}
+
+static void
+dump_chunk(void *chunk, void *caller, void *data)
+{
+    if(caller)
+	fprintf(data, "  %p from %p\n", chunk, caller);
+    else
+	fprintf(data, "  %p\n", chunk);
+}
+
+extern void
+tcmempool_dump(tcmempool_t *mp, FILE *f)
+{
+    tcmempool_stats_t st;
+
+    tcmempool_stats(mp, &st);
+    fprintf(f, "pool %p: %lu byte chunks, %lu slabs of %lu bytes\n",
+	    (void *) mp, (unsigned long) st.size, st.slabs,
+	    (unsigned long) st.slab);
+    fprintf(f, "  %lu in use of %lu, peak %lu, %lu cached\n",
+	    st.inuse, st.capacity, st.peak, st.cached);
+    fprintf(f, "  %lu maps, %lu unmaps, %lu lock waits\n",
+	    st.maps, st.unmaps, st.lockwaits);
+    tcmempool_walk(mp, dump_chunk, f);
 }
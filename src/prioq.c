@@ -25,19 +25,171 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <tctypes.h>
 #include <pthread.h>
 #include <tcprioq.h>
 
+#define PQ_ALIGN 64
+
+/*
+ * The heap is stored d-ary, with the children of node i at d*i+1 to
+ * d*i+d.  The root is placed at index d-1 of an aligned array, so each
+ * group of siblings starts on a multiple of d.  With 4 children of 16
+ * bytes, or 8 of 8 bytes, every group fills exactly one cache line.
+ *
+ * With handles, each element has a slot recording where in the heap it
+ * is.  The heap holds the slot number along with the pointer or the
+ * priority, keeping entries at 16 bytes, and the slot holds the data.
+ * A handle is the slot number and a generation count, which changes
+ * when the slot is freed, so stale handles are detected.
+ *
+ * A relaxed queue is a MultiQueue: a set of ordinary locked queues,
+ * twice as many as there are processors.  Elements are added to a
+ * random one, and taken from the better of two random ones, comparing
+ * the published tops.  Threads rarely meet on the same lock, and what
+ * is returned is close to, but not always, the smallest element.
+ */
+
+enum { pq_ptr, pq_ent, pq_hptr, pq_hprio };
+
+typedef struct pqent {
+    uint64_t prio;
+    void *data;
+} pqent_t;
+
+typedef struct pqhent {
+    union {
+	void *data;
+	uint64_t prio;
+    } k;
+    uint32_t slot;
+} pqhent_t;
+
+/* Free slots are chained through pos, stored as -2 - next. */
+typedef struct pqslot {
+    void *data;
+    int pos;
+    uint32_t gen;
+} pqslot_t;
+
 struct tcprioq {
-    void **qt;
+    void *qt;
+    void *heap;
     int size;
     int count;
+    int shift;
+    int mode;
+    uint32_t flags;
     tccompare_fn cmp;
+    pqslot_t *slots;
+    int nslots;
+    int freeslot;
+    unsigned seq;
+    int topok;
+    void *top;
+    uint64_t topprio;
+    int items;
+    tcprioq_t **sub;
+    int nsub;
     int locking;
     pthread_mutex_t lock;
 };
 
+#define ptr_lt(pq, a, b) ((pq)->cmp(a, b) < 0)
+#define ent_lt(pq, a, b) ((a).prio < (b).prio)
+#define hptr_lt(pq, a, b) ((pq)->cmp((a).k.data, (b).k.data) < 0)
+#define hprio_lt(pq, a, b) ((a).k.prio < (b).k.prio)
+
+#define set_plain(pq, q, i, x) ((q)[i] = (x))
+#define set_slot(pq, q, i, x) ((q)[i] = (x), (pq)->slots[(q)[i].slot].pos = (i))
+
+#define PQ_SIFT(name, type, lt, set)					\
+static void								\
+name##_up(tcprioq_t *pq, type *q, int i)				\
+{									\
+    type x = q[i];							\
+									\
+    while(i > 0){							\
+	int p = (i - 1) >> pq->shift;					\
+	if(!lt(pq, x, q[p]))						\
+	    break;							\
+	set(pq, q, i, q[p]);						\
+	i = p;								\
+    }									\
+    set(pq, q, i, x);							\
+}									\
+									\
+static void								\
+name##_down(tcprioq_t *pq, type *q, int i)				\
+{									\
+    type x = q[i];							\
+    int n = pq->count;							\
+									\
+    for(;;){								\
+	int c = (i << pq->shift) + 1;					\
+	int e = c + (1 << pq->shift);					\
+	int b, j;							\
+	if(c >= n)							\
+	    break;							\
+	if(e > n)							\
+	    e = n;							\
+	for(b = c, j = c + 1; j < e; j++)				\
+	    if(lt(pq, q[j], q[b]))					\
+		b = j;							\
+	if(!lt(pq, q[b], x))						\
+	    break;							\
+	set(pq, q, i, q[b]);						\
+	i = b;								\
+    }									\
+    set(pq, q, i, x);							\
+}									\
+									\
+static void								\
+name##_fix(tcprioq_t *pq, type *q, int i)				\
+{									\
+    if(i > 0 && lt(pq, q[i], q[(i - 1) >> pq->shift]))		\
+	name##_up(pq, q, i);						\
+    else								\
+	name##_down(pq, q, i);						\
+}									\
+									\
+static type								\
+name##_remove(tcprioq_t *pq, type *q, int i)				\
+{									\
+    type r = q[i];							\
+									\
+    if(i < --pq->count){						\
+	set(pq, q, i, q[pq->count]);					\
+	name##_fix(pq, q, i);						\
+    }									\
+									\
+    return r;								\
+}									\
+									\
+/* Restore order after appending elements from old on.  A large batch	\
+ * is heapified bottom up in linear time, a small one sifted up. */	\
+static void								\
+name##_heapify(tcprioq_t *pq, type *q, int old)				\
+{									\
+    int i;								\
+									\
+    if(pq->count - old < old){						\
+	for(i = old; i < pq->count; i++)				\
+	    name##_up(pq, q, i);					\
+	return;								\
+    }									\
+									\
+    for(i = (pq->count - 2) >> pq->shift; i >= 0; i--)			\
+	name##_down(pq, q, i);						\
+}
+
+PQ_SIFT(ptr, void *, ptr_lt, set_plain)
+PQ_SIFT(ent, pqent_t, ent_lt, set_plain)
+PQ_SIFT(hptr, pqhent_t, hptr_lt, set_slot)
+PQ_SIFT(hprio, pqhent_t, hprio_lt, set_slot)
+
 static inline void
 tcp_lock(tcprioq_t *pq){
     if(pq->locking){
@@ -52,75 +204,722 @@ tcp_unlock(tcprioq_t *pq){
     }
 }
 
-extern tcprioq_t *
-tcprioq_new(int size, int lock, tccompare_fn cmp)
+static inline size_t
+pq_entsize(tcprioq_t *pq)
 {
-    tcprioq_t *pq = malloc(sizeof(*pq));
+    return pq->mode == pq_ptr? sizeof(void *): sizeof(pqent_t);
+}
 
-    pq->qt = malloc(size * sizeof(*pq->qt));
+static int
+pq_resize(tcprioq_t *pq, int size)
+{
+    size_t es = pq_entsize(pq), pad = (1 << pq->shift) - 1;
+    void *qt;
+
+    if(posix_memalign(&qt, PQ_ALIGN, (size + pad) * es))
+	return -1;
+
+    if(pq->qt){
+	memcpy(qt, pq->qt, (pq->count + pad) * es);
+	free(pq->qt);
+    }
+
+    pq->qt = qt;
+    pq->heap = (char *) qt + pad * es;
     pq->size = size;
-    pq->count = 1;
+
+    return 0;
+}
+
+static int
+slot_alloc(tcprioq_t *pq)
+{
+    int s, n;
+
+    if(pq->freeslot < 0){
+	pqslot_t *sl;
+	n = pq->nslots? pq->nslots * 2: 16;
+	sl = realloc(pq->slots, n * sizeof(*sl));
+	if(!sl)
+	    return -1;
+	for(s = pq->nslots; s < n; s++){
+	    sl[s].pos = s + 1 < n? -3 - s: -1;
+	    sl[s].gen = 1;
+	}
+	pq->freeslot = pq->nslots;
+	pq->slots = sl;
+	pq->nslots = n;
+    }
+
+    s = pq->freeslot;
+    pq->freeslot = -2 - pq->slots[s].pos;
+    return s;
+}
+
+static void
+slot_free(tcprioq_t *pq, int s)
+{
+    pq->slots[s].gen++;
+    pq->slots[s].pos = -2 - pq->freeslot;
+    pq->freeslot = s;
+}
+
+static pqslot_t *
+slot_get(tcprioq_t *pq, tcprioq_handle_t h)
+{
+    uint32_t s = h & 0xffffffff;
+
+    if(!(pq->flags & TCPRIOQ_HANDLES) || s >= (uint32_t) pq->nslots ||
+       pq->slots[s].gen != h >> 32 || pq->slots[s].pos < 0)
+	return NULL;
+
+    return &pq->slots[s];
+}
+
+/*
+ * Make the smallest element available to tcprioq_peek.  The sequence
+ * count is odd while this is in progress, so a reader seeing the same
+ * even count before and after reading has a consistent copy.
+ */
+
+static void
+pq_publish(tcprioq_t *pq)
+{
+    void *top = NULL;
+    uint64_t prio = 0;
+
+    if(pq->count){
+	switch(pq->mode){
+	case pq_ptr:
+	    top = ((void **) pq->heap)[0];
+	    break;
+	case pq_ent:
+	    top = ((pqent_t *) pq->heap)[0].data;
+	    prio = ((pqent_t *) pq->heap)[0].prio;
+	    break;
+	default:
+	    top = pq->slots[((pqhent_t *) pq->heap)[0].slot].data;
+	    if(pq->mode == pq_hprio)
+		prio = ((pqhent_t *) pq->heap)[0].k.prio;
+	}
+    }
+
+    __atomic_store_n(&pq->seq, pq->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&pq->topok, pq->count > 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&pq->top, top, __ATOMIC_RELAXED);
+    __atomic_store_n(&pq->topprio, prio, __ATOMIC_RELAXED);
+    __atomic_store_n(&pq->seq, pq->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&pq->items, pq->count, __ATOMIC_RELAXED);
+}
+
+static int
+pq_add(tcprioq_t *pq, void *data, uint64_t prio, tcprioq_handle_t *h)
+{
+    int n = pq->count;
+
+    if(n == pq->size && pq_resize(pq, pq->size * 2))
+	return -1;
+
+    switch(pq->mode){
+    case pq_ptr:
+	((void **) pq->heap)[n] = data;
+	pq->count++;
+	ptr_up(pq, pq->heap, n);
+	break;
+    case pq_ent: {
+	pqent_t *q = pq->heap;
+	q[n].prio = prio;
+	q[n].data = data;
+	pq->count++;
+	ent_up(pq, q, n);
+	break;
+    }
+    default: {
+	pqhent_t *q = pq->heap;
+	int s = slot_alloc(pq);
+	if(s < 0)
+	    return -1;
+	pq->slots[s].data = data;
+	if(pq->mode == pq_hprio)
+	    q[n].k.prio = prio;
+	else
+	    q[n].k.data = data;
+	q[n].slot = s;
+	pq->count++;
+	if(pq->mode == pq_hprio)
+	    hprio_up(pq, q, n);
+	else
+	    hptr_up(pq, q, n);
+	if(h)
+	    *h = (uint64_t) pq->slots[s].gen << 32 | s;
+    }
+    }
+
+    pq_publish(pq);
+    return 0;
+}
+
+static void
+pq_take(tcprioq_t *pq, int i, void **ret, uint64_t *prio)
+{
+    switch(pq->mode){
+    case pq_ptr:
+	*ret = ptr_remove(pq, pq->heap, i);
+	break;
+    case pq_ent: {
+	pqent_t e = ent_remove(pq, pq->heap, i);
+	*ret = e.data;
+	if(prio)
+	    *prio = e.prio;
+	break;
+    }
+    default: {
+	pqhent_t e;
+	if(pq->mode == pq_hprio){
+	    e = hprio_remove(pq, pq->heap, i);
+	    if(prio)
+		*prio = e.k.prio;
+	} else {
+	    e = hptr_remove(pq, pq->heap, i);
+	}
+	*ret = pq->slots[e.slot].data;
+	slot_free(pq, e.slot);
+    }
+    }
+}
+
+static void
+pq_remove(tcprioq_t *pq, int i, void **ret, uint64_t *prio)
+{
+    pq_take(pq, i, ret, prio);
+    pq_publish(pq);
+}
+
+/*
+ * Append n elements and heapify.
+ */
+
+static int
+pq_build(tcprioq_t *pq, void **data, uint64_t *prio, tcprioq_handle_t *h,
+	 int n)
+{
+    int old = pq->count, size = pq->size, i;
+
+    while(size < old + n)
+	size *= 2;
+    if(size > pq->size && pq_resize(pq, size))
+	return -1;
+
+    switch(pq->mode){
+    case pq_ptr:
+	memcpy((void **) pq->heap + old, data, n * sizeof(*data));
+	pq->count += n;
+	ptr_heapify(pq, pq->heap, old);
+	break;
+    case pq_ent: {
+	pqent_t *q = pq->heap;
+	for(i = 0; i < n; i++){
+	    q[old + i].prio = prio[i];
+	    q[old + i].data = data[i];
+	}
+	pq->count += n;
+	ent_heapify(pq, q, old);
+	break;
+    }
+    default: {
+	pqhent_t *q = pq->heap;
+	for(i = 0; i < n; i++){
+	    int s = slot_alloc(pq);
+	    if(s < 0)
+		break;
+	    pq->slots[s].data = data[i];
+	    pq->slots[s].pos = old + i;
+	    if(pq->mode == pq_hprio)
+		q[old + i].k.prio = prio[i];
+	    else
+		q[old + i].k.data = data[i];
+	    q[old + i].slot = s;
+	    if(h)
+		h[i] = (uint64_t) pq->slots[s].gen << 32 | s;
+	}
+	pq->count += i;
+	if(pq->mode == pq_hprio)
+	    hprio_heapify(pq, q, old);
+	else
+	    hptr_heapify(pq, q, old);
+	if(i < n){
+	    pq_publish(pq);
+	    return -1;
+	}
+    }
+    }
+
+    pq_publish(pq);
+    return 0;
+}
+
+static int
+pq_get_many(tcprioq_t *pq, void **ret, uint64_t *prio, int n)
+{
+    int i;
+
+    for(i = 0; i < n && pq->count > 0; i++)
+	pq_take(pq, 0, ret + i, prio? prio + i: NULL);
+
+    if(i)
+	pq_publish(pq);
+
+    return i;
+}
+
+/*
+ * Read the published top of a queue.  Returns 0 if it was empty.
+ */
+
+static int
+pq_top(tcprioq_t *pq, void **ret, uint64_t *prio)
+{
+    unsigned seq;
+    void *top;
+    uint64_t p;
+    int ok;
+
+    do {
+	while((seq = __atomic_load_n(&pq->seq, __ATOMIC_ACQUIRE)) & 1)
+	    ;
+	ok = __atomic_load_n(&pq->topok, __ATOMIC_RELAXED);
+	top = __atomic_load_n(&pq->top, __ATOMIC_RELAXED);
+	p = __atomic_load_n(&pq->topprio, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while(__atomic_load_n(&pq->seq, __ATOMIC_RELAXED) != seq);
+
+    *ret = top;
+    *prio = p;
+    return ok;
+}
+
+static __thread uint32_t pq_seed;
+
+static uint32_t
+pq_random(void)
+{
+    uint32_t x = pq_seed;
+
+    if(!x)
+	x = (uint32_t) (uintptr_t) &x ^ (uint32_t) time(NULL) ^ 0x9e3779b9;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pq_seed = x;
+
+    return x;
+}
+
+static inline tcprioq_t *
+mq_pick(tcprioq_t *pq)
+{
+    return pq->sub[pq_random() % pq->nsub];
+}
+
+static int
+mq_add(tcprioq_t *pq, void *data, uint64_t prio)
+{
+    tcprioq_t *q;
+    int i, rt;
+
+    for(i = 0; i < 4; i++){
+	q = mq_pick(pq);
+	if(!pthread_mutex_trylock(&q->lock))
+	    break;
+    }
+    if(i == 4)
+	pthread_mutex_lock(&q->lock);
+
+    rt = pq_add(q, data, prio, NULL);
+    pthread_mutex_unlock(&q->lock);
+
+    return rt;
+}
+
+/*
+ * Lock the better of two random queues.  With numeric priorities the
+ * published tops are compared first, and only the chosen queue is
+ * locked.  Otherwise both are locked for the comparison.  Returns NULL
+ * if a lock was busy or both queues looked empty.
+ */
+
+static tcprioq_t *
+mq_lock_best(tcprioq_t *pq)
+{
+    tcprioq_t *a = mq_pick(pq), *b = mq_pick(pq);
+
+    if(pq->mode == pq_ent){
+	uint64_t pa, pb;
+	void *d;
+	int oa = pq_top(a, &d, &pa), ob = pq_top(b, &d, &pb);
+
+	if(!oa && !ob)
+	    return NULL;
+	if(!oa || (ob && pb < pa))
+	    a = b;
+	if(pthread_mutex_trylock(&a->lock))
+	    return NULL;
+	return a;
+    }
+
+    if(pthread_mutex_trylock(&a->lock))
+	return NULL;
+    if(b != a && !pthread_mutex_trylock(&b->lock)){
+	if(b->count && (!a->count ||
+			pq->cmp(((void **) b->heap)[0],
+				((void **) a->heap)[0]) < 0)){
+	    tcprioq_t *t = a;
+	    a = b;
+	    b = t;
+	}
+	pthread_mutex_unlock(&b->lock);
+    }
+
+    return a;
+}
+
+static int
+mq_get(tcprioq_t *pq, void **ret, uint64_t *prio)
+{
+    tcprioq_t *q;
+    int i;
+
+    for(i = 0; i < 2 * pq->nsub; i++){
+	if(!(q = mq_lock_best(pq)))
+	    continue;
+	if(q->count){
+	    pq_remove(q, 0, ret, prio);
+	    pthread_mutex_unlock(&q->lock);
+	    return 0;
+	}
+	pthread_mutex_unlock(&q->lock);
+    }
+
+    /* Probably empty, make sure. */
+    for(i = 0; i < pq->nsub; i++){
+	q = pq->sub[i];
+	pthread_mutex_lock(&q->lock);
+	if(q->count){
+	    pq_remove(q, 0, ret, prio);
+	    pthread_mutex_unlock(&q->lock);
+	    return 0;
+	}
+	pthread_mutex_unlock(&q->lock);
+    }
+
+    return -1;
+}
+
+/*
+ * The smallest of all the tops.  Without numeric priorities the
+ * queues are locked in order, keeping the best one locked, so the
+ * element compared against stays in place.
+ */
+
+static int
+mq_peek(tcprioq_t *pq, void **ret, uint64_t *prio)
+{
+    tcprioq_t *best = NULL;
+    uint64_t bp = 0, p;
+    void *d, *bd = NULL;
+    int i;
+
+    if(pq->mode == pq_ent){
+	for(i = 0; i < pq->nsub; i++)
+	    if(pq_top(pq->sub[i], &d, &p) && (!best || p < bp)){
+		bd = d;
+		bp = p;
+		best = pq->sub[i];
+	    }
+    } else {
+	for(i = 0; i < pq->nsub; i++){
+	    tcprioq_t *q = pq->sub[i];
+	    pthread_mutex_lock(&q->lock);
+	    if(q->count && (!best ||
+			    pq->cmp(((void **) q->heap)[0], bd) < 0)){
+		if(best)
+		    pthread_mutex_unlock(&best->lock);
+		best = q;
+		bd = ((void **) q->heap)[0];
+	    } else {
+		pthread_mutex_unlock(&q->lock);
+	    }
+	}
+	if(best)
+	    pthread_mutex_unlock(&best->lock);
+    }
+
+    if(!best)
+	return -1;
+
+    *ret = bd;
+    if(prio)
+	*prio = bp;
+    return 0;
+}
+
+/*
+ * Spread the elements evenly over the sub-queues.
+ */
+
+static int
+mq_build(tcprioq_t *pq, void **data, uint64_t *prio, int n)
+{
+    int i, k = 0, rt = 0;
+
+    for(i = 0; i < pq->nsub; i++){
+	tcprioq_t *q = pq->sub[i];
+	int m = n / pq->nsub + (i < n % pq->nsub);
+
+	if(!m)
+	    continue;
+	pthread_mutex_lock(&q->lock);
+	if(pq_build(q, data + k, prio? prio + k: NULL, NULL, m))
+	    rt = -1;
+	pthread_mutex_unlock(&q->lock);
+	k += m;
+    }
+
+    return rt;
+}
+
+static int
+mq_get_many(tcprioq_t *pq, void **ret, uint64_t *prio, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++)
+	if(mq_get(pq, ret + i, prio? prio + i: NULL))
+	    break;
+
+    return i;
+}
+
+static int
+mq_new(tcprioq_t *pq, int size, tccompare_fn cmp, uint32_t flags)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    pq->nsub = n > 1? 2 * n: 2;
+    pq->sub = calloc(pq->nsub, sizeof(*pq->sub));
+    if(!pq->sub)
+	return -1;
+
+    for(i = 0; i < pq->nsub; i++){
+	pq->sub[i] = tcprioq_newf(size / pq->nsub + 1, 1, cmp,
+				  flags & ~TCPRIOQ_RELAXED);
+	if(!pq->sub[i])
+	    return -1;
+    }
+
+    return 0;
+}
+
+extern tcprioq_t *
+tcprioq_newf(int size, int lock, tccompare_fn cmp, uint32_t flags)
+{
+    tcprioq_t *pq;
+
+    if((flags & TCPRIOQ_ARITY4) && (flags & TCPRIOQ_ARITY8))
+	return NULL;
+    if(!cmp && !(flags & TCPRIOQ_PRIO))
+	return NULL;
+    if((flags & TCPRIOQ_RELAXED) && (flags & TCPRIOQ_HANDLES))
+	return NULL;
+
+    pq = calloc(1, sizeof(*pq));
+    pq->shift = flags & TCPRIOQ_ARITY8? 3: flags & TCPRIOQ_ARITY4? 2: 1;
+    pq->flags = flags;
     pq->cmp = cmp;
+    pq->freeslot = -1;
+
+    if(flags & TCPRIOQ_HANDLES)
+	pq->mode = flags & TCPRIOQ_PRIO? pq_hprio: pq_hptr;
+    else
+	pq->mode = flags & TCPRIOQ_PRIO? pq_ent: pq_ptr;
+
+    if(flags & TCPRIOQ_RELAXED){
+	if(mq_new(pq, size, cmp, flags)){
+	    tcprioq_free(pq);
+	    return NULL;
+	}
+	return pq;
+    }
+
     pq->locking = lock;
     if(lock)
 	pthread_mutex_init(&pq->lock, NULL);
 
+    if(pq_resize(pq, size > 0? size: 1)){
+	tcprioq_free(pq);
+	return NULL;
+    }
+
     return pq;
 }
 
+extern tcprioq_t *
+tcprioq_new(int size, int lock, tccompare_fn cmp)
+{
+    return tcprioq_newf(size, lock, cmp, 0);
+}
+
 extern int
 tcprioq_add(tcprioq_t *pq, void *data)
 {
-    int i;
+    int rt;
+
+    if(pq->flags & TCPRIOQ_PRIO)
+	return -1;
+    if(pq->sub)
+	return mq_add(pq, data, 0);
 
     tcp_lock(pq);
+    rt = pq_add(pq, data, 0, NULL);
+    tcp_unlock(pq);
 
-    if(pq->count == pq->size){
-	pq->qt = realloc(pq->qt, (pq->size *= 2) * sizeof(*pq->qt));
-    }
+    return rt;
+}
 
-    i = pq->count;
-    pq->qt[i] = data;
+extern int
+tcprioq_addp(tcprioq_t *pq, void *data, uint64_t prio)
+{
+    int rt;
 
-    while(i > 1 && pq->cmp(pq->qt[i/2], pq->qt[i]) > 0){
-	void *tmp = pq->qt[i];
-	pq->qt[i] = pq->qt[i/2];
-	pq->qt[i/2] = tmp;
-	i /= 2;
-    }
+    if(!(pq->flags & TCPRIOQ_PRIO))
+	return -1;
+    if(pq->sub)
+	return mq_add(pq, data, prio);
 
-    pq->count++;
+    tcp_lock(pq);
+    rt = pq_add(pq, data, prio, NULL);
+    tcp_unlock(pq);
 
+    return rt;
+}
+
+extern int
+tcprioq_addh(tcprioq_t *pq, void *data, uint64_t prio, tcprioq_handle_t *h)
+{
+    int rt;
+
+    if(!(pq->flags & TCPRIOQ_HANDLES))
+	return -1;
+
+    tcp_lock(pq);
+    rt = pq_add(pq, data, prio, h);
     tcp_unlock(pq);
-    return 0;
+
+    return rt;
 }
 
 extern int
-tcprioq_get(tcprioq_t *pq, void **ret)
+tcprioq_getp(tcprioq_t *pq, void **ret, uint64_t *prio)
 {
     int rt = -1;
 
+    if(pq->sub)
+	return mq_get(pq, ret, prio);
+
+    tcp_lock(pq);
+
+    if(pq->count > 0){
+	pq_remove(pq, 0, ret, prio);
+	rt = 0;
+    }
+
+    tcp_unlock(pq);
+    return rt;
+}
+
+extern int
+tcprioq_get(tcprioq_t *pq, void **ret)
+{
+    return tcprioq_getp(pq, ret, NULL);
+}
+
+extern int
+tcprioq_build(tcprioq_t *pq, void **data, uint64_t *prio,
+	      tcprioq_handle_t *h, int n)
+{
+    int rt;
+
+    if(n <= 0)
+	return n < 0? -1: 0;
+    if(!prio != !(pq->flags & TCPRIOQ_PRIO))
+	return -1;
+    if(h && !(pq->flags & TCPRIOQ_HANDLES))
+	return -1;
+
+    if(pq->sub)
+	return mq_build(pq, data, prio, n);
+
+    tcp_lock(pq);
+    rt = pq_build(pq, data, prio, h, n);
+    tcp_unlock(pq);
+
+    return rt;
+}
+
+extern int
+tcprioq_get_many(tcprioq_t *pq, void **ret, uint64_t *prio, int n)
+{
+    int rt;
+
+    if(pq->sub)
+	return mq_get_many(pq, ret, prio, n);
+
+    tcp_lock(pq);
+    rt = pq_get_many(pq, ret, prio, n);
+    tcp_unlock(pq);
+
+    return rt;
+}
+
+extern int
+tcprioq_update(tcprioq_t *pq, tcprioq_handle_t h, uint64_t prio)
+{
+    pqslot_t *s;
+    int rt = 1;
+
     tcp_lock(pq);
 
-    if(pq->count > 1){
-	int i;
-	void *r;
-
-	r = pq->qt[1];
-	pq->qt[1] = pq->qt[pq->count-1];
-	pq->count--;
-
-	i = 1;
-	while((2*i < pq->count && pq->cmp(pq->qt[i], pq->qt[2*i]) > 0) ||
-	      (2*i < pq->count-1 && pq->cmp(pq->qt[i], pq->qt[2*i+1]) > 0)){
-	    void *tmp = pq->qt[i];
-	    i = (2*i < pq->count-1 && pq->cmp(pq->qt[2*i], pq->qt[2*i+1]) > 0)?
-		 2*i+1: 2*i;
-	    pq->qt[i/2] = pq->qt[i];
-	    pq->qt[i] = tmp;
+    if((s = slot_get(pq, h))){
+	if(pq->mode == pq_hprio){
+	    ((pqhent_t *) pq->heap)[s->pos].k.prio = prio;
+	    hprio_fix(pq, pq->heap, s->pos);
+	} else {
+	    hptr_fix(pq, pq->heap, s->pos);
 	}
+	pq_publish(pq);
+	rt = 0;
+    }
 
-	*ret = r;
+    tcp_unlock(pq);
+    return rt;
+}
+
+extern int
+tcprioq_remove(tcprioq_t *pq, tcprioq_handle_t h, void **ret)
+{
+    pqslot_t *s;
+    void *data;
+    int rt = 1;
+
+    tcp_lock(pq);
+
+    if((s = slot_get(pq, h))){
+	pq_remove(pq, s->pos, &data, NULL);
+	if(ret)
+	    *ret = data;
 	rt = 0;
     }
 
@@ -128,16 +927,58 @@ tcprioq_get(tcprioq_t *pq, void **ret)
     return rt;
 }
 
+extern int
+tcprioq_peekp(tcprioq_t *pq, void **ret, uint64_t *prio)
+{
+    void *top;
+    uint64_t p;
+
+    if(pq->sub)
+	return mq_peek(pq, ret, prio);
+
+    if(!pq_top(pq, &top, &p))
+	return -1;
+
+    *ret = top;
+    if(prio)
+	*prio = p;
+    return 0;
+}
+
+extern int
+tcprioq_peek(tcprioq_t *pq, void **ret)
+{
+    return tcprioq_peekp(pq, ret, NULL);
+}
+
 extern int
 tcprioq_items(tcprioq_t *pq)
 {
-    return pq->count - 1;
+    int i, n = 0;
+
+    if(!pq->sub)
+	return pq->count;
+
+    for(i = 0; i < pq->nsub; i++)
+	n += __atomic_load_n(&pq->sub[i]->items, __ATOMIC_RELAXED);
+
+    return n;
 }
 
 extern void
-tprioq_free(tcprioq_t *pq)
+tcprioq_free(tcprioq_t *pq)
 {
+    int i;
+
+    if(pq->sub){
+	for(i = 0; i < pq->nsub; i++)
+	    if(pq->sub[i])
+		tcprioq_free(pq->sub[i]);
+	free(pq->sub);
+    }
     free(pq->qt);
-    pthread_mutex_destroy(&pq->lock);
+    free(pq->slots);
+    if(pq->locking)
+	pthread_mutex_destroy(&pq->lock);
     free(pq);
 }
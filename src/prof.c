@@ -0,0 +1,421 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * Allocation observers and a sampling heap profiler.  Allocations
+ * made while an observer runs are not reported, so observers may use
+ * libtc themselves.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+#include <tcprof.h>
+#include <tchash.h>
+#include <tcarena.h>
+#include "tcm-internal.h"
+
+#define TCPROF_OBSERVERS 8
+
+int tcprof_active;
+
+static tcprof_observer_t *observers[TCPROF_OBSERVERS];
+static pthread_mutex_t observer_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int prof_busy;
+
+static const char *subsystems[TCPROF_SUBSYSTEMS] = {
+    "other", "tcalloc", "tcmem", "tcmempool", "tcarena",
+    "tclist", "tchash", "tctree", "tcconf"
+};
+
+extern void
+prof_alloc(void *p, size_t size, int subsys, const char *tag)
+{
+    tcprof_observer_t *o;
+    int i;
+
+    if(prof_busy)
+	return;
+
+    prof_busy = 1;
+    for(i = 0; i < TCPROF_OBSERVERS; i++)
+	if((o = __atomic_load_n(&observers[i], __ATOMIC_ACQUIRE)) && o->alloc)
+	    o->alloc(p, size, subsys, tag, o->data);
+    prof_busy = 0;
+}
+
+extern void
+prof_free(void *p)
+{
+    tcprof_observer_t *o;
+    int i;
+
+    if(prof_busy)
+	return;
+
+    prof_busy = 1;
+    for(i = 0; i < TCPROF_OBSERVERS; i++)
+	if((o = __atomic_load_n(&observers[i], __ATOMIC_ACQUIRE)) && o->free)
+	    o->free(p, o->data);
+    prof_busy = 0;
+}
+
+extern int
+tcprof_observe(tcprof_observer_t *o)
+{
+    int i, ret = -1;
+
+    pthread_mutex_lock(&observer_lock);
+    for(i = 0; i < TCPROF_OBSERVERS; i++){
+	if(!observers[i]){
+	    __atomic_store_n(&observers[i], o, __ATOMIC_RELEASE);
+	    __atomic_add_fetch(&tcprof_active, 1, __ATOMIC_RELAXED);
+	    ret = 0;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&observer_lock);
+
+    return ret;
+}
+
+extern int
+tcprof_unobserve(tcprof_observer_t *o)
+{
+    int i, ret = -1;
+
+    pthread_mutex_lock(&observer_lock);
+    for(i = 0; i < TCPROF_OBSERVERS; i++){
+	if(observers[i] == o){
+	    __atomic_store_n(&observers[i], NULL, __ATOMIC_RELEASE);
+	    __atomic_sub_fetch(&tcprof_active, 1, __ATOMIC_RELAXED);
+	    ret = 0;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&observer_lock);
+
+    return ret;
+}
+
+extern const char *
+tcprof_subsystem(int subsys)
+{
+    if(subsys < 0 || subsys >= TCPROF_SUBSYSTEMS)
+	return NULL;
+    return subsystems[subsys];
+}
+
+/*
+ * The heap profiler samples about one in rate allocations, at random
+ * intervals so periodic allocation patterns are not missed.  Samples
+ * are counted in buckets by subsystem and stack, and remembered until
+ * freed.  Each sample stands for rate allocations in the profile.
+ */
+
+#define HEAP_DEPTH 32
+#define HEAP_SKIP 2		/* heap_alloc and prof_alloc */
+
+typedef struct heap_key {
+    int subsys, depth;
+    void *pc[HEAP_DEPTH];
+} heap_key_t;
+
+typedef struct heap_bucket {
+    size_t allocs, alloc_bytes;
+    size_t objs, bytes;
+    struct heap_bucket *next;
+    heap_key_t key;
+} heap_bucket_t;
+
+typedef struct heap_sample {
+    heap_bucket_t *bucket;
+    size_t size;
+} heap_sample_t;
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long heap_rate;
+static tchash_table_t *heap_buckets, *heap_live;
+static heap_bucket_t *heap_list;
+static size_t heap_nlive;
+
+static __thread long heap_countdown;
+static __thread unsigned long heap_seed;
+
+static long
+heap_interval(void)
+{
+    unsigned long r = heap_rate;
+
+    if(r <= 1)
+	return 1;
+
+    if(!heap_seed)
+	heap_seed = ((uintptr_t) &heap_seed ^ time(NULL)) | 1;
+    heap_seed ^= heap_seed << 13;
+    heap_seed ^= heap_seed >> 7;
+    heap_seed ^= heap_seed << 17;
+
+    return 1 + heap_seed % (2 * r - 1);
+}
+
+static size_t
+key_size(heap_key_t *k)
+{
+    return offsetof(heap_key_t, pc) + k->depth * sizeof(k->pc[0]);
+}
+
+static void
+heap_alloc(void *p, size_t size, int subsys, const char *tag, void *data)
+{
+    heap_bucket_t *b;
+    heap_sample_t *s, *old;
+    heap_key_t k;
+    int first;
+
+    (void) tag;
+    (void) data;
+
+    if(heap_countdown > 1){
+	heap_countdown--;
+	return;
+    }
+    first = !heap_countdown;
+    heap_countdown = heap_interval();
+    if(first && heap_countdown > 1)
+	return;
+
+    memset(&k, 0, sizeof(k));
+    k.subsys = subsys;
+#ifdef HAVE_EXECINFO_H
+    {
+	void *pc[HEAP_DEPTH + HEAP_SKIP];
+	int n = backtrace(pc, HEAP_DEPTH + HEAP_SKIP);
+
+	if(n > HEAP_SKIP){
+	    k.depth = n - HEAP_SKIP;
+	    memcpy(k.pc, pc + HEAP_SKIP, k.depth * sizeof(k.pc[0]));
+	}
+    }
+#endif
+
+    if(!(s = malloc(sizeof(*s))))
+	return;
+
+    pthread_mutex_lock(&heap_lock);
+    if(!heap_live){
+	pthread_mutex_unlock(&heap_lock);
+	free(s);
+	return;
+    }
+
+    if(tchash_find(heap_buckets, &k, key_size(&k), &b)){
+	if(!(b = calloc(1, sizeof(*b)))){
+	    pthread_mutex_unlock(&heap_lock);
+	    free(s);
+	    return;
+	}
+	b->key = k;
+	b->next = heap_list;
+	heap_list = b;
+	tchash_replace(heap_buckets, &b->key, key_size(&k), b, NULL);
+    }
+
+    b->allocs++;
+    b->alloc_bytes += size;
+    b->objs++;
+    b->bytes += size;
+    s->bucket = b;
+    s->size = size;
+    if(!tchash_replace(heap_live, &p, sizeof(p), s, &old)){
+	/* The old block was freed without a report, as arena blocks are. */
+	old->bucket->objs--;
+	old->bucket->bytes -= old->size;
+	free(old);
+    } else {
+	__atomic_add_fetch(&heap_nlive, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static void
+heap_free(void *p, void *data)
+{
+    heap_sample_t *s;
+
+    (void) data;
+
+    if(!__atomic_load_n(&heap_nlive, __ATOMIC_RELAXED))
+	return;
+
+    pthread_mutex_lock(&heap_lock);
+    if(heap_live && !tchash_delete(heap_live, &p, sizeof(p), &s)){
+	s->bucket->objs--;
+	s->bucket->bytes -= s->size;
+	__atomic_sub_fetch(&heap_nlive, 1, __ATOMIC_RELAXED);
+	free(s);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static tcprof_observer_t heap_observer = { heap_alloc, heap_free, NULL };
+
+/* Drop all samples.  Called with heap_lock held. */
+static void
+heap_clear(void)
+{
+    heap_bucket_t *b, *n;
+
+    if(heap_live){
+	tchash_destroy(heap_live, free);
+	tchash_destroy(heap_buckets, NULL);
+    }
+    for(b = heap_list; b; b = n){
+	n = b->next;
+	free(b);
+    }
+    heap_live = heap_buckets = NULL;
+    heap_list = NULL;
+    __atomic_store_n(&heap_nlive, 0, __ATOMIC_RELAXED);
+}
+
+extern int
+tcprof_heap_start(unsigned long rate)
+{
+    tcarena_t *a;
+    int ret = -1;
+
+    prof_busy++;
+    pthread_mutex_lock(&heap_lock);
+    if(!heap_live && rate){
+	a = tcarena_use(NULL);
+	heap_buckets = tchash_new(256, 0, TCHASH_NOCOPY);
+	heap_live = tchash_new(1024, 0, 0);
+	tcarena_use(a);
+	heap_rate = rate;
+	ret = 0;
+    }
+    pthread_mutex_unlock(&heap_lock);
+
+    if(!ret && tcprof_observe(&heap_observer)){
+	pthread_mutex_lock(&heap_lock);
+	heap_clear();
+	pthread_mutex_unlock(&heap_lock);
+	ret = -1;
+    }
+    prof_busy--;
+
+    return ret;
+}
+
+extern int
+tcprof_heap_stop(void)
+{
+    if(tcprof_unobserve(&heap_observer))
+	return -1;
+
+    prof_busy++;
+    pthread_mutex_lock(&heap_lock);
+    heap_clear();
+    pthread_mutex_unlock(&heap_lock);
+    prof_busy--;
+
+    return 0;
+}
+
+/*
+ * The profile is in the text format of gperftools, which pprof reads.
+ * The counts are already scaled, so the header has no sampling rate.
+ * The memory map lets pprof find the symbols.
+ */
+
+extern int
+tcprof_heap_dump(FILE *f)
+{
+    size_t objs = 0, bytes = 0, allocs = 0, abytes = 0;
+    unsigned long r;
+    heap_bucket_t *b;
+    FILE *maps;
+    char buf[1024];
+    size_t n;
+    int i;
+
+    pthread_mutex_lock(&heap_lock);
+    if(!heap_live){
+	pthread_mutex_unlock(&heap_lock);
+	return -1;
+    }
+
+    r = heap_rate;
+    for(b = heap_list; b; b = b->next){
+	objs += b->objs;
+	bytes += b->bytes;
+	allocs += b->allocs;
+	abytes += b->alloc_bytes;
+    }
+
+    fprintf(f, "heap profile: %zu: %zu [%zu: %zu] @ heapprofile\n",
+	    objs * r, bytes * r, allocs * r, abytes * r);
+    for(b = heap_list; b; b = b->next){
+	fprintf(f, "%zu: %zu [%zu: %zu] @", b->objs * r, b->bytes * r,
+		b->allocs * r, b->alloc_bytes * r);
+	for(i = 0; i < b->key.depth; i++)
+	    fprintf(f, " %p", b->key.pc[i]);
+	fputc('\n', f);
+    }
+    pthread_mutex_unlock(&heap_lock);
+
+    fprintf(f, "\nMAPPED_LIBRARIES:\n");
+    if((maps = fopen("/proc/self/maps", "r"))){
+	while((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+	    fwrite(buf, 1, n, f);
+	fclose(maps);
+    }
+
+    return ferror(f)? -1: 0;
+}
+
+extern size_t
+tcprof_heap_inuse(int subsys)
+{
+    heap_bucket_t *b;
+    size_t bytes = 0;
+
+    pthread_mutex_lock(&heap_lock);
+    for(b = heap_list; b; b = b->next)
+	if(b->key.subsys == subsys)
+	    bytes += b->bytes;
+    bytes *= heap_rate;
+    pthread_mutex_unlock(&heap_lock);
+
+    return bytes;
+}
@@ -0,0 +1,467 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * Persistent AVL tree engine for tctree.  Nodes are reference counted
+ * with tcalloc and shared between the tree and its snapshots.  An
+ * update copies the nodes on the path it changes, leaving the old
+ * version intact for any snapshot still using it.
+ *
+ * Each node records the generation of the tree it was made in.  Taking
+ * a snapshot starts a new generation, so nodes from an earlier one are
+ * copied before being changed, while newer nodes are only reachable
+ * from the tree itself and are changed in place.
+ *
+ * Reference counts are only touched with the lock shared by a tree and
+ * its snapshots held.  Readers of a snapshot touch nothing at all.
+ */
+
+#include <stdlib.h>
+#include <tcalloc.h>
+#include "tct-internal.h"
+
+#define TCM_SUBSYS TCPROF_TREE
+#include "tcm-internal.h"
+
+struct pnode {
+    pnode_t *left;
+    pnode_t *right;
+    void *key;
+    int height;
+    unsigned long gen;
+};
+
+static void
+pnode_free(void *p)
+{
+    pnode_t *n = p;
+    tcfree(n->left);
+    tcfree(n->right);
+}
+
+static pnode_t *
+p_node(tctree_t *t, void *key)
+{
+    pnode_t *n = tca_allocd(NULL, sizeof(*n), NULL, pnode_free);
+
+    n->left = NULL;
+    n->right = NULL;
+    n->key = key;
+    n->height = 1;
+    n->gen = t->pgen;
+
+    return n;
+}
+
+/*
+ * Return a node that can be changed in the current version of the
+ * tree.  The reference to n held by its parent is passed on to the
+ * copy, so the caller must store the result where n was.
+ */
+
+static pnode_t *
+p_own(tctree_t *t, pnode_t *n)
+{
+    pnode_t *c;
+
+    if(n->gen == t->pgen)
+	return n;
+
+    c = tca_allocd(NULL, sizeof(*c), NULL, pnode_free);
+    *c = *n;
+    c->gen = t->pgen;
+    if(c->left)
+	tcref(c->left);
+    if(c->right)
+	tcref(c->right);
+    tcfree(n);
+
+    return c;
+}
+
+static inline int
+p_height(pnode_t *n)
+{
+    return n? n->height: 0;
+}
+
+static inline void
+p_fix(pnode_t *n)
+{
+    int l = p_height(n->left), r = p_height(n->right);
+    n->height = (l > r? l: r) + 1;
+}
+
+static pnode_t *
+p_rotate_right(tctree_t *t, pnode_t *n)
+{
+    pnode_t *l = n->left = p_own(t, n->left);
+
+    n->left = l->right;
+    l->right = n;
+    p_fix(n);
+    p_fix(l);
+
+    return l;
+}
+
+static pnode_t *
+p_rotate_left(tctree_t *t, pnode_t *n)
+{
+    pnode_t *r = n->right = p_own(t, n->right);
+
+    n->right = r->left;
+    r->left = n;
+    p_fix(n);
+    p_fix(r);
+
+    return r;
+}
+
+static pnode_t *
+p_balance(tctree_t *t, pnode_t *n)
+{
+    int d = p_height(n->left) - p_height(n->right);
+
+    if(d > 1){
+	if(p_height(n->left->left) < p_height(n->left->right)){
+	    n->left = p_own(t, n->left);
+	    n->left = p_rotate_left(t, n->left);
+	}
+	return p_rotate_right(t, n);
+    } else if(d < -1){
+	if(p_height(n->right->right) < p_height(n->right->left)){
+	    n->right = p_own(t, n->right);
+	    n->right = p_rotate_right(t, n->right);
+	}
+	return p_rotate_left(t, n);
+    }
+
+    p_fix(n);
+    return n;
+}
+
+static pnode_t *
+p_insert(tctree_t *t, pnode_t *n, void *key, void **old)
+{
+    int result;
+
+    if(!n)
+	return p_node(t, key);
+
+    n = p_own(t, n);
+    result = tct_compare(t, key, n->key);
+    if(result < 0){
+	n->left = p_insert(t, n->left, key, old);
+    } else if(result > 0){
+	n->right = p_insert(t, n->right, key, old);
+    } else {
+	*old = n->key;
+	n->key = key;
+	return n;
+    }
+
+    return p_balance(t, n);
+}
+
+/*
+ * Unlink a node that is owned by the current version, keeping only
+ * the given child.
+ */
+
+static pnode_t *
+p_unlink(pnode_t *n, pnode_t *child)
+{
+    if(child)
+	tcref(child);
+    tcfree(n);
+    return child;
+}
+
+static pnode_t *
+p_delmin(tctree_t *t, pnode_t *n, void **key)
+{
+    n = p_own(t, n);
+    if(!n->left){
+	*key = n->key;
+	return p_unlink(n, n->right);
+    }
+
+    n->left = p_delmin(t, n->left, key);
+    return p_balance(t, n);
+}
+
+static pnode_t *
+p_delete(tctree_t *t, pnode_t *n, void *key, void **old)
+{
+    int result;
+
+    n = p_own(t, n);
+    result = tct_compare(t, key, n->key);
+    if(result < 0){
+	n->left = p_delete(t, n->left, key, old);
+    } else if(result > 0){
+	n->right = p_delete(t, n->right, key, old);
+    } else {
+	*old = n->key;
+	if(!n->left)
+	    return p_unlink(n, n->right);
+	if(!n->right)
+	    return p_unlink(n, n->left);
+	n->right = p_delmin(t, n->right, &n->key);
+    }
+
+    return p_balance(t, n);
+}
+
+extern void
+ptree_init(tctree_t *t)
+{
+    t->pshare = tcm_alloc(sizeof(*t->pshare));
+    pthread_mutex_init(&t->pshare->lock, NULL);
+    t->pshare->users = 1;
+    t->locking = 1;
+}
+
+extern tctree_t *
+ptree_snapshot(tctree_t *t)
+{
+    tctree_t *s = tcm_zalloc(sizeof(*s));
+
+    s->compare = t->compare;
+    s->keytype = t->keytype;
+    s->flags = t->flags | TCTREE_READONLY;
+    s->pshare = t->pshare;
+    pthread_mutex_init(&s->lock, NULL);
+
+    pthread_mutex_lock(&t->pshare->lock);
+    s->nodecount = t->nodecount;
+    s->proot = t->proot;
+    if(s->proot)
+	tcref(s->proot);
+    s->pshare->users++;
+    t->pgen++;
+    pthread_mutex_unlock(&t->pshare->lock);
+
+    return s;
+}
+
+static void
+p_free_keys(pnode_t *n, tcfree_fn f)
+{
+    if(!n)
+	return;
+    p_free_keys(n->left, f);
+    p_free_keys(n->right, f);
+    f(n->key);
+}
+
+/*
+ * Drop this version of the tree.  Nodes still used by other versions
+ * are kept, so the shared lock must be held even when the tree itself
+ * is not locked.
+ */
+
+extern void
+ptree_destroy(tctree_t *t, tcfree_fn f)
+{
+    ptshare_t *ps = t->pshare;
+    int users;
+
+    pthread_mutex_lock(&ps->lock);
+    if(f && !(t->flags & TCTREE_READONLY))
+	p_free_keys(t->proot, f);
+    tcfree(t->proot);
+    users = --ps->users;
+    pthread_mutex_unlock(&ps->lock);
+
+    if(!users){
+	pthread_mutex_destroy(&ps->lock);
+	tcm_free(ps);
+    }
+}
+
+extern void **
+ptree_find(tctree_t *t, void *key)
+{
+    pnode_t *n = t->proot;
+    int result;
+
+    while(n){
+	result = tct_compare(t, key, n->key);
+	if(result < 0)
+	    n = n->left;
+	else if(result > 0)
+	    n = n->right;
+	else
+	    return &n->key;
+    }
+
+    return NULL;
+}
+
+extern int
+ptree_search(tctree_t *t, void *key, void *r, int replace)
+{
+    void **ret = r;
+    void **k = ptree_find(t, key);
+    void *old = NULL;
+
+    if(k){
+	if(ret)
+	    *ret = *k;
+	if(replace)
+	    t->proot = p_insert(t, t->proot, key, &old);
+	return 0;
+    }
+
+    t->proot = p_insert(t, t->proot, key, &old);
+    t->nodecount++;
+    if(ret)
+	*ret = key;
+    return 1;
+}
+
+extern int
+ptree_delete(tctree_t *t, void *key, void *r)
+{
+    void **ret = r;
+    void *old;
+
+    if(!ptree_find(t, key))
+	return 1;
+
+    t->proot = p_delete(t, t->proot, key, &old);
+    t->nodecount--;
+    if(ret)
+	*ret = old;
+    return 0;
+}
+
+extern void **
+ptree_ceil(tctree_t *t, void *key, int incl)
+{
+    pnode_t *n = t->proot, *best = NULL;
+    int result;
+
+    while(n){
+	result = tct_compare(t, key, n->key);
+	if(result < 0 || (result == 0 && incl)){
+	    best = n;
+	    n = n->left;
+	} else {
+	    n = n->right;
+	}
+    }
+
+    return best? &best->key: NULL;
+}
+
+extern void **
+ptree_floor(tctree_t *t, void *key, int incl)
+{
+    pnode_t *n = t->proot, *best = NULL;
+    int result;
+
+    while(n){
+	result = tct_compare(t, key, n->key);
+	if(result > 0 || (result == 0 && incl)){
+	    best = n;
+	    n = n->right;
+	} else {
+	    n = n->left;
+	}
+    }
+
+    return best? &best->key: NULL;
+}
+
+extern void **
+ptree_first(tctree_t *t)
+{
+    pnode_t *n = t->proot;
+
+    if(!n)
+	return NULL;
+    while(n->left)
+	n = n->left;
+
+    return &n->key;
+}
+
+extern void **
+ptree_last(tctree_t *t)
+{
+    pnode_t *n = t->proot;
+
+    if(!n)
+	return NULL;
+    while(n->right)
+	n = n->right;
+
+    return &n->key;
+}
+
+static void
+p_collect(pnode_t *n, void **keys, unsigned long *i)
+{
+    if(!n)
+	return;
+    p_collect(n->left, keys, i);
+    keys[(*i)++] = n->key;
+    p_collect(n->right, keys, i);
+}
+
+extern unsigned long
+ptree_collect(tctree_t *t, void **keys)
+{
+    unsigned long n = 0;
+    p_collect(t->proot, keys, &n);
+    return n;
+}
+
+static pnode_t *
+p_build(tctree_t *t, void **keys, unsigned long lo, unsigned long hi)
+{
+    unsigned long mid;
+    pnode_t *n;
+
+    if(lo >= hi)
+	return NULL;
+
+    mid = lo + (hi - lo) / 2;
+    n = p_node(t, keys[mid]);
+    n->left = p_build(t, keys, lo, mid);
+    n->right = p_build(t, keys, mid + 1, hi);
+    p_fix(n);
+
+    return n;
+}
+
+extern void
+ptree_build(tctree_t *t, void **keys, unsigned long n)
+{
+    tcfree(t->proot);
+    t->proot = p_build(t, keys, 0, n);
+}
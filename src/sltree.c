@@ -0,0 +1,558 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * Concurrent skip list engine for tctree, after "A Simple Optimistic
+ * Skiplist Algorithm" by Herlihy, Lev, Luchangco and Shavit.  Lookups
+ * and iteration take no locks at all.  Writers lock only the nodes
+ * immediately before the one being linked or unlinked, and validate
+ * them before changing anything.
+ *
+ * Unlinked nodes may still be in use by readers, so they are kept on
+ * limbo lists until no reader can hold a pointer to them.  Every
+ * operation runs within an epoch, counted per tree.  The epoch is only
+ * advanced when no reader is left in the previous one, so nodes
+ * retired two epochs ago can always be freed.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <sched.h>
+#include <time.h>
+#include "tct-internal.h"
+
+#define TCM_SUBSYS TCPROF_TREE
+#include "tcm-internal.h"
+
+#define SL_MAXLEVEL 24
+#define SL_RECLAIM  64
+
+struct slnode {
+    void *key;
+    int height;
+    int marked;
+    int linked;
+    int lock;
+    slnode_t *rnext;
+    slnode_t *next[1];
+};
+
+#define sl_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define sl_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static __thread uint32_t sl_seed;
+
+static int
+sl_level(void)
+{
+    uint32_t x = sl_seed;
+    int l = 1;
+
+    if(!x)
+	x = (uint32_t) (uintptr_t) &x ^ (uint32_t) time(NULL) ^ 0x9e3779b9;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sl_seed = x;
+
+    while(l < SL_MAXLEVEL && !(x & 3)){
+	x >>= 2;
+	l++;
+    }
+
+    return l;
+}
+
+static inline void
+sl_lock(slnode_t *n)
+{
+    while(__atomic_exchange_n(&n->lock, 1, __ATOMIC_ACQUIRE))
+	while(__atomic_load_n(&n->lock, __ATOMIC_RELAXED))
+	    sched_yield();
+}
+
+static inline void
+sl_unlock(slnode_t *n)
+{
+    __atomic_store_n(&n->lock, 0, __ATOMIC_RELEASE);
+}
+
+static slnode_t *
+sl_alloc(tctree_t *t, void *key, int height)
+{
+    slnode_t *n = tca_alloc(t->arena,
+			    offsetof(slnode_t, next) + height * sizeof(n));
+
+    n->key = key;
+    n->height = height;
+    n->marked = 0;
+    n->linked = 0;
+    n->lock = 0;
+    n->rnext = NULL;
+
+    return n;
+}
+
+extern void
+sltree_init(tctree_t *t)
+{
+    int i;
+
+    t->shead = sl_alloc(t, NULL, SL_MAXLEVEL);
+    for(i = 0; i < SL_MAXLEVEL; i++)
+	t->shead->next[i] = NULL;
+    t->shead->linked = 1;
+    pthread_mutex_init(&t->rlock, NULL);
+}
+
+extern unsigned long
+sltree_enter(tctree_t *t)
+{
+    unsigned long e;
+
+    for(;;){
+	e = __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&t->readers[e % 3], 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST) == e)
+	    return e;
+	__atomic_sub_fetch(&t->readers[e % 3], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+extern void
+sltree_leave(tctree_t *t, unsigned long e)
+{
+    __atomic_sub_fetch(&t->readers[e % 3], 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+sl_freelist(tctree_t *t, slnode_t *n)
+{
+    while(n){
+	slnode_t *nn = n->rnext;
+	tca_free(t->arena, n);
+	n = nn;
+    }
+}
+
+/*
+ * Advance the epoch if no reader remains in the previous one.  Nodes
+ * retired two epochs ago are freed first, since their list is about
+ * to be reused.  Never waits: if readers are in the way, or another
+ * thread is already at it, try again after the next deletion.
+ */
+
+static void
+sl_reclaim(tctree_t *t)
+{
+    unsigned long e;
+
+    if(pthread_mutex_trylock(&t->rlock))
+	return;
+
+    e = t->epoch;
+    if(!__atomic_load_n(&t->readers[(e + 2) % 3], __ATOMIC_SEQ_CST)){
+	sl_freelist(t, t->limbo[(e + 1) % 3]);
+	t->limbo[(e + 1) % 3] = NULL;
+	__atomic_store_n(&t->epoch, e + 1, __ATOMIC_SEQ_CST);
+	t->nretired = 0;
+    }
+
+    pthread_mutex_unlock(&t->rlock);
+}
+
+static int
+sl_retire(tctree_t *t, slnode_t *n)
+{
+    unsigned long e;
+    int full;
+
+    pthread_mutex_lock(&t->rlock);
+    e = __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST);
+    n->rnext = t->limbo[e % 3];
+    t->limbo[e % 3] = n;
+    full = ++t->nretired >= SL_RECLAIM;
+    pthread_mutex_unlock(&t->rlock);
+
+    return full;
+}
+
+static inline int
+sl_valid(slnode_t *n)
+{
+    return sl_load(&n->linked) && !sl_load(&n->marked);
+}
+
+/*
+ * Find the predecessors and successors of key at every level.  Returns
+ * the highest level where a node with an equal key was found, or -1.
+ */
+
+static int
+sl_find(tctree_t *t, void *key, slnode_t **preds, slnode_t **succs)
+{
+    slnode_t *pred = t->shead, *curr;
+    int found = -1, result = 0, l;
+
+    for(l = SL_MAXLEVEL - 1; l >= 0; l--){
+	while((curr = sl_load(&pred->next[l])) &&
+	      (result = tct_compare(t, key, curr->key)) > 0)
+	    pred = curr;
+	if(found < 0 && curr && !result)
+	    found = l;
+	preds[l] = pred;
+	succs[l] = curr;
+    }
+
+    return found;
+}
+
+static void
+sl_unlock_preds(slnode_t **preds, int highest)
+{
+    slnode_t *prev = NULL;
+    int l;
+
+    for(l = 0; l <= highest; l++){
+	if(preds[l] != prev)
+	    sl_unlock(preds[l]);
+	prev = preds[l];
+    }
+}
+
+extern int
+sltree_find(tctree_t *t, void *key, void *r)
+{
+    slnode_t *preds[SL_MAXLEVEL], *succs[SL_MAXLEVEL];
+    void **ret = r;
+    unsigned long e;
+    int found;
+
+    e = sltree_enter(t);
+
+    found = sl_find(t, key, preds, succs);
+    if(found >= 0 && sl_valid(succs[found])){
+	if(ret)
+	    *ret = sl_load(&succs[found]->key);
+    } else {
+	found = -1;
+    }
+
+    sltree_leave(t, e);
+    return found < 0;
+}
+
+extern int
+sltree_search(tctree_t *t, void *key, void *r, int replace)
+{
+    slnode_t *preds[SL_MAXLEVEL], *succs[SL_MAXLEVEL];
+    slnode_t *node, *pred, *succ, *prev;
+    void **ret = r;
+    unsigned long e;
+    int found, height, highest, valid, l;
+
+    e = sltree_enter(t);
+
+    for(;;){
+	found = sl_find(t, key, preds, succs);
+	if(found >= 0){
+	    node = succs[found];
+	    if(sl_load(&node->marked))
+		continue;
+	    while(!sl_load(&node->linked))
+		sched_yield();
+	    if(ret)
+		*ret = sl_load(&node->key);
+	    if(replace)
+		sl_store(&node->key, key);
+	    sltree_leave(t, e);
+	    return 0;
+	}
+
+	height = sl_level();
+	highest = -1;
+	valid = 1;
+	prev = NULL;
+
+	for(l = 0; valid && l < height; l++){
+	    pred = preds[l];
+	    succ = succs[l];
+	    if(pred != prev){
+		sl_lock(pred);
+		highest = l;
+		prev = pred;
+	    }
+	    valid = !sl_load(&pred->marked) &&
+		(!succ || !sl_load(&succ->marked)) &&
+		sl_load(&pred->next[l]) == succ;
+	}
+
+	if(!valid){
+	    sl_unlock_preds(preds, highest);
+	    continue;
+	}
+
+	node = sl_alloc(t, key, height);
+	for(l = 0; l < height; l++)
+	    node->next[l] = succs[l];
+	for(l = 0; l < height; l++)
+	    sl_store(&preds[l]->next[l], node);
+	sl_store(&node->linked, 1);
+
+	sl_unlock_preds(preds, highest);
+	break;
+    }
+
+    __atomic_add_fetch(&t->nodecount, 1, __ATOMIC_RELAXED);
+    sltree_leave(t, e);
+
+    if(ret)
+	*ret = key;
+    return 1;
+}
+
+extern int
+sltree_delete(tctree_t *t, void *key, void *r)
+{
+    slnode_t *preds[SL_MAXLEVEL], *succs[SL_MAXLEVEL];
+    slnode_t *victim = NULL, *pred, *prev;
+    void **ret = r;
+    unsigned long e;
+    int found, top = -1, marked = 0, reclaim = 0, highest, valid, l;
+
+    e = sltree_enter(t);
+
+    for(;;){
+	found = sl_find(t, key, preds, succs);
+
+	if(!marked){
+	    if(found < 0)
+		break;
+	    victim = succs[found];
+	    if(!sl_valid(victim) || victim->height - 1 != found)
+		break;
+	    top = victim->height - 1;
+	    sl_lock(victim);
+	    if(sl_load(&victim->marked)){
+		sl_unlock(victim);
+		break;
+	    }
+	    sl_store(&victim->marked, 1);
+	    marked = 1;
+	}
+
+	highest = -1;
+	valid = 1;
+	prev = NULL;
+
+	for(l = 0; valid && l <= top; l++){
+	    pred = preds[l];
+	    if(pred != prev){
+		sl_lock(pred);
+		highest = l;
+		prev = pred;
+	    }
+	    valid = !sl_load(&pred->marked) &&
+		sl_load(&pred->next[l]) == victim;
+	}
+
+	if(!valid){
+	    sl_unlock_preds(preds, highest);
+	    continue;
+	}
+
+	for(l = top; l >= 0; l--)
+	    sl_store(&preds[l]->next[l], victim->next[l]);
+
+	sl_unlock(victim);
+	sl_unlock_preds(preds, highest);
+	break;
+    }
+
+    if(marked){
+	if(ret)
+	    *ret = sl_load(&victim->key);
+	__atomic_sub_fetch(&t->nodecount, 1, __ATOMIC_RELAXED);
+	reclaim = sl_retire(t, victim);
+    }
+
+    sltree_leave(t, e);
+
+    if(reclaim)
+	sl_reclaim(t);
+
+    return !marked;
+}
+
+/*
+ * Smallest valid node with key greater than (or equal to) key.
+ */
+
+static slnode_t *
+sl_ceil(tctree_t *t, void *key, int incl)
+{
+    slnode_t *pred = t->shead, *curr;
+    int result, l;
+
+    for(l = SL_MAXLEVEL - 1; l >= 0; l--){
+	while((curr = sl_load(&pred->next[l])) &&
+	      ((result = tct_compare(t, key, curr->key)) > 0 ||
+	       (result == 0 && !incl)))
+	    pred = curr;
+    }
+
+    curr = sl_load(&pred->next[0]);
+    while(curr && !sl_valid(curr))
+	curr = sl_load(&curr->next[0]);
+
+    return curr;
+}
+
+/*
+ * Largest valid node with key less than (or equal to) key.  If the
+ * node found is being removed, look again below its key.
+ */
+
+static slnode_t *
+sl_floor(tctree_t *t, void *key, int incl)
+{
+    slnode_t *pred, *curr;
+    int result, l;
+
+    for(;;){
+	pred = t->shead;
+	for(l = SL_MAXLEVEL - 1; l >= 0; l--){
+	    while((curr = sl_load(&pred->next[l])) &&
+		  ((result = tct_compare(t, key, curr->key)) > 0 ||
+		   (result == 0 && incl)))
+		pred = curr;
+	}
+
+	if(pred == t->shead)
+	    return NULL;
+	if(sl_valid(pred))
+	    return pred;
+
+	key = pred->key;
+	incl = 0;
+    }
+}
+
+static slnode_t *
+sl_last(tctree_t *t)
+{
+    slnode_t *pred = t->shead, *curr;
+    int l;
+
+    for(l = SL_MAXLEVEL - 1; l >= 0; l--)
+	while((curr = sl_load(&pred->next[l])))
+	    pred = curr;
+
+    if(pred == t->shead)
+	return NULL;
+    if(sl_valid(pred))
+	return pred;
+
+    return sl_floor(t, pred->key, 0);
+}
+
+extern int
+sltree_bound(tctree_t *t, void *key, void *r, int incl)
+{
+    void **ret = r;
+    slnode_t *n;
+    unsigned long e;
+
+    e = sltree_enter(t);
+
+    n = sl_ceil(t, key, incl);
+    if(n && ret)
+	*ret = sl_load(&n->key);
+
+    sltree_leave(t, e);
+    return !n;
+}
+
+/*
+ * Step a cursor.  The caller keeps the cursor within an epoch for as
+ * long as it is active, so the node it points to stays allocated even
+ * if it is removed from the list, and its successors are still valid.
+ */
+
+extern void **
+sltree_cursor_step(tctree_cursor_t *c, void **np)
+{
+    tctree_t *t = c->tree;
+    slnode_t *n;
+
+    if(c->flags & TCTREE_REVERSE){
+	if(c->state == cursor_start){
+	    if(c->flags & TCTREE_NOHIGH)
+		n = sl_last(t);
+	    else
+		n = sl_floor(t, c->high, !(c->flags & TCTREE_EXCLHIGH));
+	} else {
+	    n = sl_floor(t, c->key, 0);
+	}
+    } else {
+	if(c->state == cursor_start){
+	    if(c->flags & TCTREE_NOLOW){
+		n = sl_load(&t->shead->next[0]);
+		while(n && !sl_valid(n))
+		    n = sl_load(&n->next[0]);
+	    } else {
+		n = sl_ceil(t, c->low, !(c->flags & TCTREE_EXCLLOW));
+	    }
+	} else {
+	    n = sl_load(&((slnode_t *) c->node)->next[0]);
+	    while(n && !sl_valid(n))
+		n = sl_load(&n->next[0]);
+	}
+    }
+
+    *np = n;
+    return n? &n->key: NULL;
+}
+
+extern void
+sltree_destroy(tctree_t *t, tcfree_fn f)
+{
+    slnode_t *n, *nn;
+    int i;
+
+    /* Nodes from an arena only need walking for their keys. */
+    for(n = t->arena && !f? NULL: t->shead->next[0]; n; n = nn){
+	nn = n->next[0];
+	if(f)
+	    f(n->key);
+	tca_free(t->arena, n);
+    }
+
+    for(i = 0; i < 3 && !t->arena; i++)
+	sl_freelist(t, t->limbo[i]);
+
+    tca_free(t->arena, t->shead);
+    pthread_mutex_destroy(&t->rlock);
+}
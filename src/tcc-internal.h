@@ -27,6 +27,7 @@
 
 #include <tctypes.h>
 #include <tclist.h>
+#include <tcarena.h>
 
 #define TCC_INTEGER  1
 #define TCC_FLOAT    2
@@ -55,6 +56,7 @@ struct _conf_section {
     tclist_t *entries;
     tclist_t *merge;
     conf_section *parent;
+    tcarena_t *arena;
 };
 
 struct tcconf_section {
@@ -73,6 +75,7 @@ typedef struct {
 	tclist_t *values;
     } value;
     conf_section *section;
+    tcarena_t *arena;
 } tcc_entry;
 
 
@@ -84,5 +87,6 @@ extern int tcc_addbool(tcc_entry *, int);
 extern int tcc_addref(tcc_entry *te, char *ref);
 extern conf_section *tcc_lex(void *, tcio_fn, conf_section *);
 extern tcc_entry *create_entry(conf_section *sec, char *name, int type);
+extern char *tcc_strdup(const char *s);
 
 #endif
@@ -0,0 +1,193 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+#ifndef _TCM_INTERNAL_H
+#define _TCM_INTERNAL_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <tcmem.h>
+#include <tcarena.h>
+#include <tcalloc.h>
+#include <tcmempool.h>
+#include <tcprof.h>
+
+/*
+ * Allocations are reported to the observers of tcprof.h by the
+ * outermost libtc function only.  Internally libtc uses the silent
+ * mem_ and mempool_ functions, through the wrappers below, which
+ * report with the subsystem TCM_SUBSYS, defined by each file before
+ * including this one, and the calling function as tag.
+ */
+
+#ifndef TCM_SUBSYS
+#define TCM_SUBSYS TCPROF_OTHER
+#endif
+
+extern int tcprof_active;
+extern void prof_alloc(void *p, size_t size, int subsys, const char *tag);
+extern void prof_free(void *p);
+
+static inline void *
+tcp_alloc(void *p, size_t size, int subsys, const char *tag)
+{
+    if(__builtin_expect(__atomic_load_n(&tcprof_active, __ATOMIC_RELAXED), 0) && p)
+	prof_alloc(p, size, subsys, tag);
+    return p;
+}
+
+static inline void
+tcp_free(void *p)
+{
+    if(__builtin_expect(__atomic_load_n(&tcprof_active, __ATOMIC_RELAXED), 0) && p)
+	prof_free(p);
+}
+
+extern int tcmem_active;
+extern void *mem_alloc(size_t size);
+extern void *mem_zalloc(size_t size);
+extern void *mem_realloc(void *p, size_t size);
+extern void mem_free(void *p);
+extern void *mempool_get(tcmempool_t *mp);
+extern size_t mempool_release(void *p);
+
+/* tcallocf flag taking the block from malloc rather than tcmem, for
+ * the objects tcmem itself is built on. */
+#define TCALLOC_MALLOC 0x80000000
+
+/*
+ * Allocation for libtc's own use, through tcmem if enabled with
+ * tcmem_use, else malloc.  Only for memory never handed to the caller
+ * to free.  tcm_free and tcm_realloc handle both kinds.
+ */
+
+static inline void *
+tcm_alloc_(size_t size, int subsys, const char *tag)
+{
+    void *p = tcmem_active? mem_alloc(size): malloc(size);
+    return tcp_alloc(p, size, subsys, tag);
+}
+
+static inline void *
+tcm_zalloc_(size_t size, int subsys, const char *tag)
+{
+    void *p = tcmem_active? mem_zalloc(size): calloc(1, size);
+    return tcp_alloc(p, size, subsys, tag);
+}
+
+static inline void *
+tcm_realloc_(void *p, size_t size, int subsys, const char *tag)
+{
+    void *q;
+
+    if(!p)
+	return tcm_alloc_(size, subsys, tag);
+    if((q = mem_realloc(p, size)))
+	tcp_free(p);
+    return tcp_alloc(q, size, subsys, tag);
+}
+
+static inline char *
+tcm_strdup_(const char *s, int subsys, const char *tag)
+{
+    size_t l = strlen(s) + 1;
+    char *d = tcm_alloc_(l, subsys, tag);
+
+    if(d)
+	memcpy(d, s, l);
+
+    return d;
+}
+
+static inline void
+tcm_free(void *p)
+{
+    tcp_free(p);
+    mem_free(p);
+}
+
+#define tcm_alloc(size) tcm_alloc_(size, TCM_SUBSYS, __func__)
+#define tcm_zalloc(size) tcm_zalloc_(size, TCM_SUBSYS, __func__)
+#define tcm_realloc(p, size) tcm_realloc_(p, size, TCM_SUBSYS, __func__)
+#define tcm_strdup(s) tcm_strdup_(s, TCM_SUBSYS, __func__)
+
+/* Chunks of size bytes from a pool of libtc's own. */
+#define tcm_poolget(mp, size) \
+    tcp_alloc(mempool_get(mp), size, TCM_SUBSYS, __func__)
+
+static inline void
+tcm_poolfree(void *p)
+{
+    tcp_free(p);
+    mempool_release(p);
+}
+
+/*
+ * Allocation for containers, from arena a if set.  Arena memory is
+ * never freed on its own, and only reported by the block.  Containers
+ * take a from tcarena_current when created.
+ */
+
+extern __thread tcarena_t *tcarena_current;
+
+static inline void *
+tca_alloc_(tcarena_t *a, size_t size, int subsys, const char *tag)
+{
+    return a? tcarena_alloc(a, size): tcm_alloc_(size, subsys, tag);
+}
+
+static inline void *
+tca_zalloc_(tcarena_t *a, size_t size, int subsys, const char *tag)
+{
+    void *p;
+
+    if(!a)
+	return tcm_zalloc_(size, subsys, tag);
+    if((p = tcarena_alloc(a, size)))
+	memset(p, 0, size);
+    return p;
+}
+
+static inline void
+tca_free(tcarena_t *a, void *p)
+{
+    if(!a)
+	tcm_free(p);
+}
+
+#define tca_alloc(a, size) tca_alloc_(a, size, TCM_SUBSYS, __func__)
+#define tca_zalloc(a, size) tca_zalloc_(a, size, TCM_SUBSYS, __func__)
+
+/* Like tcallocf, from arena a if set.  tcfree runs the free function
+ * as usual, but leaves the memory to the arena. */
+extern void *tca_allocf(tcarena_t *a, size_t size, tc_ref_fn r,
+			tcfree_fn f, uint32_t flags, int subsys,
+			const char *tag);
+
+#define tca_allocd(a, size, r, f) \
+    tca_allocf(a, size, r, f, 0, TCM_SUBSYS, __func__)
+#define tca_allocdz(a, size, r, f) \
+    tca_allocf(a, size, r, f, TCALLOC_ZERO, TCM_SUBSYS, __func__)
+
+#endif
@@ -0,0 +1,167 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+#ifndef _TCT_INTERNAL_H
+#define _TCT_INTERNAL_H
+
+#include <pthread.h>
+#include <string.h>
+#include <tctypes.h>
+#include <tctree.h>
+#include <tcmempool.h>
+#include <tcarena.h>
+
+typedef enum { dnode_red, dnode_black } dnode_color_t;
+
+typedef struct dnode_t {
+    struct dnode_t *left;
+    struct dnode_t *right;
+    struct dnode_t *parent;
+    dnode_color_t color;
+    unsigned long count;
+    void *key;
+} dnode_t;
+
+typedef struct btnode btnode_t;
+typedef struct slnode slnode_t;
+typedef struct pnode pnode_t;
+
+/* Lock shared by a persistent tree and its snapshots. */
+typedef struct ptshare {
+    pthread_mutex_t lock;
+    int users;
+} ptshare_t;
+
+/* Key types with built-in comparison. */
+enum { tct_key_fn, tct_key_int, tct_key_u64, tct_key_str };
+
+/* Internal tree flags. */
+#define TCTREE_READONLY 0x80000000
+
+enum { cursor_start, cursor_active, cursor_done };
+
+struct tctree {
+    dnode_t nilnode;
+    int nodecount;
+    tccompare_fn compare;
+    int locking;
+    pthread_mutex_t lock;
+    uint32_t flags;
+    int keytype;
+    tcmempool_t *mp;
+    tcarena_t *arena;
+    unsigned long gen;
+    btnode_t *broot;
+    size_t nodesize;
+    int lcap, icap;
+    slnode_t *shead;
+    unsigned long epoch;
+    long readers[3];
+    slnode_t *limbo[3];
+    unsigned nretired;
+    pthread_mutex_t rlock;
+    pnode_t *proot;
+    unsigned long pgen;
+    ptshare_t *pshare;
+};
+
+struct tctree_cursor {
+    tctree_t *tree;
+    void *node;
+    int idx;
+    void *key;
+    void *low, *high;
+    uint32_t flags;
+    unsigned long gen;
+    unsigned long epoch;
+    int state;
+};
+
+/*
+ * Compare keys of the given type.  Loops calling this with a constant
+ * type get the comparison inlined instead of calling t->compare.
+ */
+
+static inline int
+tct_keycmp(tctree_t *t, int type, const void *a, const void *b)
+{
+    switch(type){
+    case tct_key_int:
+	return ((intptr_t) a > (intptr_t) b) - ((intptr_t) a < (intptr_t) b);
+    case tct_key_u64:
+	return (*(const uint64_t *) a > *(const uint64_t *) b) -
+	    (*(const uint64_t *) a < *(const uint64_t *) b);
+    case tct_key_str:
+	return strcmp(a, b);
+    }
+    return t->compare(a, b);
+}
+
+static inline int
+tct_compare(tctree_t *t, const void *a, const void *b)
+{
+    return tct_keycmp(t, t->keytype, a, b);
+}
+
+extern void btree_init(tctree_t *t);
+extern int btree_setnodesize(tctree_t *t, size_t size);
+extern void **btree_find(tctree_t *t, void *key);
+extern int btree_search(tctree_t *t, void *key, void *ret, int replace);
+extern int btree_delete(tctree_t *t, void *key, void *ret);
+extern void btree_destroy(tctree_t *t, tcfree_fn f);
+extern void **btree_first(tctree_t *t, btnode_t **n, int *i);
+extern void **btree_last(tctree_t *t, btnode_t **n, int *i);
+extern void **btree_ceil(tctree_t *t, void *key, int incl,
+			 btnode_t **n, int *i);
+extern void **btree_floor(tctree_t *t, void *key, int incl,
+			  btnode_t **n, int *i);
+extern void **btree_next(btnode_t **n, int *i);
+extern void **btree_prev(btnode_t **n, int *i);
+extern unsigned long btree_collect(tctree_t *t, void **keys);
+extern void btree_build(tctree_t *t, void **keys, unsigned long n);
+
+extern void sltree_init(tctree_t *t);
+extern void sltree_destroy(tctree_t *t, tcfree_fn f);
+extern int sltree_find(tctree_t *t, void *key, void *ret);
+extern int sltree_search(tctree_t *t, void *key, void *ret, int replace);
+extern int sltree_delete(tctree_t *t, void *key, void *ret);
+extern int sltree_bound(tctree_t *t, void *key, void *ret, int incl);
+extern unsigned long sltree_enter(tctree_t *t);
+extern void sltree_leave(tctree_t *t, unsigned long e);
+extern void **sltree_cursor_step(tctree_cursor_t *c, void **np);
+
+extern void ptree_init(tctree_t *t);
+extern tctree_t *ptree_snapshot(tctree_t *t);
+extern void ptree_destroy(tctree_t *t, tcfree_fn f);
+extern void **ptree_find(tctree_t *t, void *key);
+extern int ptree_search(tctree_t *t, void *key, void *ret, int replace);
+extern int ptree_delete(tctree_t *t, void *key, void *ret);
+extern void **ptree_ceil(tctree_t *t, void *key, int incl);
+extern void **ptree_floor(tctree_t *t, void *key, int incl);
+extern void **ptree_first(tctree_t *t);
+extern void **ptree_last(tctree_t *t);
+extern unsigned long ptree_collect(tctree_t *t, void **keys);
+extern void ptree_build(tctree_t *t, void **keys, unsigned long n);
+
+#endif
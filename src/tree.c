@@ -26,26 +26,13 @@
 #include <stddef.h>
 #include <pthread.h>
 #include <tctree.h>
+#include <tcmempool.h>
+#include <tcalloc.h>
 #include <assert.h>
+#include "tct-internal.h"
 
-typedef enum { dnode_red, dnode_black } dnode_color_t;
-
-typedef struct dnode_t {
-    struct dnode_t *left;
-    struct dnode_t *right;
-    struct dnode_t *parent;
-    dnode_color_t color;
-    void *key;
-} dnode_t;
-
-struct tctree {
-    dnode_t nilnode;
-    int nodecount;
-    tccompare_fn compare;
-    int locking;
-    pthread_mutex_t lock;
-    uint32_t flags;
-};
+#define TCM_SUBSYS TCPROF_TREE
+#include "tcm-internal.h"
 
 #define dict_root(D) ((D)->nilnode.left)
 #define dict_nil(D) (&(D)->nilnode)
@@ -56,9 +43,10 @@ struct tctree {
  * its right child C are rearranged so that the P instead becomes the left
  * child of C.   The left subtree of C is inherited as the new right subtree
  * for P.  The ordering of the keys within the tree is thus preserved.
+ * If the tree keeps subtree sizes, only those of P and C change.
  */
 
-static void rotate_left(dnode_t *upper)
+static void rotate_left(tctree_t *dict, dnode_t *upper)
 {
     dnode_t *lower, *lowleft, *upparent;
 
@@ -80,6 +68,11 @@ static void rotate_left(dnode_t *upper)
 
     lower->left = upper;
     upper->parent = lower;
+
+    if (dict->flags & TCTREE_RANK) {
+	lower->count = upper->count;
+	upper->count = upper->left->count + upper->right->count + 1;
+    }
 }
 
 /*
@@ -87,7 +80,7 @@ static void rotate_left(dnode_t *upper)
  * the same procedure, but with left and right interchanged.
  */
 
-static void rotate_right(dnode_t *upper)
+static void rotate_right(tctree_t *dict, dnode_t *upper)
 {
     dnode_t *lower, *lowright, *upparent;
 
@@ -106,107 +99,243 @@ static void rotate_right(dnode_t *upper)
 
     lower->right = upper;
     upper->parent = lower;
+
+    if (dict->flags & TCTREE_RANK) {
+	lower->count = upper->count;
+	upper->count = upper->left->count + upper->right->count + 1;
+    }
 }
 
 static inline void
 tree_lock(tctree_t *t)
 {
     if(t->locking)
-	pthread_mutex_lock(&t->lock);
+	pthread_mutex_lock(t->pshare? &t->pshare->lock: &t->lock);
 }
 
 static inline void
 tree_unlock(tctree_t *t)
 {
     if(t->locking)
-	pthread_mutex_unlock(&t->lock);
+	pthread_mutex_unlock(t->pshare? &t->pshare->lock: &t->lock);
+}
+
+static inline dnode_t *
+dnode_alloc(tctree_t *t)
+{
+    if(t->mp)
+	return tcm_poolget(t->mp, sizeof(dnode_t));
+    return tcarena_alloc(t->arena, sizeof(dnode_t));
+}
+
+#define TCTREE_ENGINES (TCTREE_BTREE | TCTREE_CONCURRENT | TCTREE_PERSISTENT)
+#define TCTREE_KEYS (TCTREE_INTKEY | TCTREE_U64KEY | TCTREE_STRKEY)
+
+static int
+cmp_int(const void *a, const void *b)
+{
+    return tct_keycmp(NULL, tct_key_int, a, b);
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    return tct_keycmp(NULL, tct_key_u64, a, b);
+}
+
+static int
+cmp_str(const void *a, const void *b)
+{
+    return tct_keycmp(NULL, tct_key_str, a, b);
 }
 
 extern tctree_t *
 tctree_new(int lock, tccompare_fn cmp, uint32_t flags)
 {
-    tctree_t *t = calloc(1, sizeof(*t));
+    uint32_t engine = flags & TCTREE_ENGINES, keys = flags & TCTREE_KEYS;
+    tcarena_t *a = tcarena_current;
+    tctree_t *t;
+
+    if((engine & (engine - 1)) || (engine && (flags & TCTREE_RANK)))
+	return NULL;
+    if((keys & (keys - 1)) || (!keys && !cmp))
+	return NULL;
+    flags &= ~TCTREE_READONLY;
+
+    /* Persistent nodes are shared with snapshots by reference count. */
+    if(flags & TCTREE_PERSISTENT)
+	a = NULL;
+
+    t = tca_zalloc(a, sizeof(*t));
+    t->arena = a;
 
     t->nilnode.left = &t->nilnode;
     t->nilnode.right = &t->nilnode;
     t->nilnode.parent = &t->nilnode;
     t->nilnode.color = dnode_black;
     t->compare = cmp;
+    t->keytype = tct_key_fn;
+    if(keys == TCTREE_INTKEY){
+	t->compare = cmp_int;
+	t->keytype = tct_key_int;
+    } else if(keys == TCTREE_U64KEY){
+	t->compare = cmp_u64;
+	t->keytype = tct_key_u64;
+    } else if(keys == TCTREE_STRKEY){
+	t->compare = cmp_str;
+	t->keytype = tct_key_str;
+    }
     t->locking = lock;
     pthread_mutex_init(&t->lock, NULL);
     t->flags = flags;
 
+    if(flags & TCTREE_CONCURRENT){
+	t->locking = 0;
+	sltree_init(t);
+    } else if(flags & TCTREE_PERSISTENT)
+	ptree_init(t);
+    else if(flags & TCTREE_BTREE)
+	btree_init(t);
+    else if(!a)
+	t->mp = tcmempool_new(sizeof(dnode_t), 0);
+
     return t;
 }
 
+extern tctree_t *
+tctree_snapshot(tctree_t *t)
+{
+    if(!(t->flags & TCTREE_PERSISTENT))
+	return NULL;
+    return ptree_snapshot(t);
+}
+
+extern int
+tctree_setnodesize(tctree_t *t, size_t size)
+{
+    int r = -1;
+
+    tree_lock(t);
+    if(t->flags & TCTREE_BTREE)
+	r = btree_setnodesize(t, size);
+    tree_unlock(t);
+
+    return r;
+}
+
 /*
  * Do a postorder traversal of the tree rooted at the specified
- * node and free everything under it.  Used by dict_free().
+ * node and free all keys under it.  The nodes themselves are
+ * released along with the node pool.
  */
 
 static void
-free_nodes(dnode_t *node, dnode_t *nil, tcfree_fn fr)
+free_keys(dnode_t *node, dnode_t *nil, tcfree_fn fr)
 {
     if (node == nil)
 	return;
-    free_nodes(node->left, nil, fr);
-    free_nodes(node->right, nil, fr);
-    if(fr)
-	fr(node->key);
-    free(node);
+    free_keys(node->left, nil, fr);
+    free_keys(node->right, nil, fr);
+    fr(node->key);
 }
 
 extern int
 tctree_destroy(tctree_t *t, tcfree_fn f)
 {
     dnode_t *nil = dict_nil(t), *root = dict_root(t);
-    free_nodes(root, nil, f);
+    if(t->flags & TCTREE_CONCURRENT)
+	sltree_destroy(t, f);
+    else if(t->flags & TCTREE_PERSISTENT)
+	ptree_destroy(t, f);
+    else if(t->flags & TCTREE_BTREE)
+	btree_destroy(t, f);
+    else if(f)
+	free_keys(root, nil, f);
+    tcfree(t->mp);
     pthread_mutex_destroy(&t->lock);
+    tca_free(t->arena, t);
     return 0;
 }
 
 /*
- * Locate a node in the dictionary having the given key.
- * If the node is not found, a null a pointer is returned (rather than 
- * a pointer that dictionary's nil sentinel node), otherwise a pointer to the
- * located node is returned.
+ * Descend towards key, returning the node holding an equal key with
+ * *cmp set to 0, or the node below which key belongs.  Each key type
+ * gets its own copy of the loop, with the comparison inlined.
  */
 
-static dnode_t *
-do_find(tctree_t *dict, void *key)
+static inline dnode_t *
+lookup_type(tctree_t *dict, void *key, int type, int *cmp)
 {
-    dnode_t *root = dict_root(dict);
-    dnode_t *nil = dict_nil(dict);
-    int result;
+    dnode_t *where = dict_root(dict), *nil = dict_nil(dict);
+    dnode_t *parent = nil;
+    int result = -1;
 
-    while (root != nil) {
-	result = dict->compare(key, root->key);
+    while (where != nil) {
+	parent = where;
+	result = tct_keycmp(dict, type, key, where->key);
 	if (result < 0)
-	    root = root->left;
+	    where = where->left;
 	else if (result > 0)
-	    root = root->right;
-	else {
-	    return root;
-	}
+	    where = where->right;
+	else
+	    break;
+    }
+
+    *cmp = result;
+    return parent;
+}
+
+static dnode_t *
+do_lookup(tctree_t *dict, void *key, int *cmp)
+{
+    switch (dict->keytype) {
+    case tct_key_int:
+	return lookup_type(dict, key, tct_key_int, cmp);
+    case tct_key_u64:
+	return lookup_type(dict, key, tct_key_u64, cmp);
+    case tct_key_str:
+	return lookup_type(dict, key, tct_key_str, cmp);
     }
+    return lookup_type(dict, key, tct_key_fn, cmp);
+}
+
+static dnode_t *
+do_find(tctree_t *dict, void *key)
+{
+    int result;
+    dnode_t *node = do_lookup(dict, key, &result);
 
-    return NULL;
+    if (node == dict_nil(dict) || result)
+	return NULL;
+
+    return node;
 }
 
 extern int
 tctree_find(tctree_t *dict, void *key, void *r)
 {
-    dnode_t *node;
     void **ret = r;
+    void **k;
+
+    if(dict->flags & TCTREE_CONCURRENT)
+	return sltree_find(dict, key, r);
 
     tree_lock(dict);
 
-    node = do_find(dict, key);
-    if(node && ret)
-	*ret = node->key;
+    if(dict->flags & TCTREE_PERSISTENT){
+	k = ptree_find(dict, key);
+    } else if(dict->flags & TCTREE_BTREE){
+	k = btree_find(dict, key);
+    } else {
+	dnode_t *node = do_find(dict, key);
+	k = node? &node->key: NULL;
+    }
+
+    if(k && ret)
+	*ret = *k;
 
     tree_unlock(dict);
-    return !node;
+    return !k;
 }
 
 /*
@@ -220,34 +349,45 @@ tctree_find(tctree_t *dict, void *key, void *r)
 static int
 do_search(tctree_t *dict, void *key,  void *r, int replace)
 {
-    dnode_t *where = dict_root(dict), *nil = dict_nil(dict);
-    dnode_t *parent = nil, *uncle, *grandpa;
+    dnode_t *nil = dict_nil(dict);
+    dnode_t *parent, *uncle, *grandpa;
     dnode_t *node;
     void **ret = r;
-    int result = -1;
+    int result;
+
+    if(dict->flags & TCTREE_CONCURRENT)
+	return sltree_search(dict, key, r, replace);
+    if(dict->flags & TCTREE_READONLY)
+	return -1;
 
     tree_lock(dict);
 
-    while (where != nil) {
-	parent = where;
-	result = dict->compare(key, where->key);
-	if(result < 0){
-	    where = where->left;
-	} else if(result > 0){
-	    where = where->right;
-	} else {
-	    *ret = where->key;
-	    if(replace)
-		where->key = key;
-	    tree_unlock(dict);
-	    return 0;
-	}
+    if(dict->flags & TCTREE_PERSISTENT){
+	result = ptree_search(dict, key, r, replace);
+	tree_unlock(dict);
+	return result;
+    }
+
+    if(dict->flags & TCTREE_BTREE){
+	result = btree_search(dict, key, r, replace);
+	tree_unlock(dict);
+	return result;
+    }
+
+    parent = do_lookup(dict, key, &result);
+    if (parent != nil && !result) {
+	if(ret)
+	    *ret = parent->key;
+	if(replace)
+	    parent->key = key;
+	tree_unlock(dict);
+	return 0;
     }
 
     if(ret)
 	*ret = key;
 
-    node = malloc(sizeof(*node));
+    node = dnode_alloc(dict);
     node->key = key;
 
     if (result < 0)
@@ -259,7 +399,15 @@ do_search(tctree_t *dict, void *key,  void *r, int replace)
     node->left = nil;
     node->right = nil;
 
+    if (dict->flags & TCTREE_RANK) {
+	dnode_t *p;
+	node->count = 1;
+	for (p = parent; p != nil; p = p->parent)
+	    p->count++;
+    }
+
     dict->nodecount++;
+    dict->gen++;
 
     /* red black adjustments */
 
@@ -277,14 +425,14 @@ do_search(tctree_t *dict, void *key,  void *r, int replace)
 		parent = grandpa->parent;
 	    } else {				/* red parent, black uncle */
 	    	if (node == parent->right) {
-		    rotate_left(parent);
+		    rotate_left(dict, parent);
 		    parent = node;
 		    assert (grandpa == parent->parent);
 		    /* rotation between parent and child preserves grandpa */
 		}
 		parent->color = dnode_black;
 		grandpa->color = dnode_red;
-		rotate_right(grandpa);
+		rotate_right(dict, grandpa);
 		break;
 	    }
 	} else { 	/* symmetric cases: parent == parent->parent->right */
@@ -297,13 +445,13 @@ do_search(tctree_t *dict, void *key,  void *r, int replace)
 		parent = grandpa->parent;
 	    } else {
 	    	if (node == parent->left) {
-		    rotate_right(parent);
+		    rotate_right(dict, parent);
 		    parent = node;
 		    assert (grandpa == parent->parent);
 		}
 		parent->color = dnode_black;
 		grandpa->color = dnode_red;
-		rotate_left(grandpa);
+		rotate_left(dict, grandpa);
 		break;
 	    }
 	}
@@ -334,7 +482,8 @@ tctree_replace(tctree_t *t, void *key, void *ret)
  * the nil node.
  */
 
-dnode_t *dict_next(tctree_t *dict, dnode_t *curr)
+static dnode_t *
+dict_next(tctree_t *dict, dnode_t *curr)
 {
     dnode_t *nil = dict_nil(dict), *parent, *left;
 
@@ -355,6 +504,618 @@ dnode_t *dict_next(tctree_t *dict, dnode_t *curr)
     return (parent == nil) ? NULL : parent;
 }
 
+/*
+ * Return the given node's predecessor, in the same manner as dict_next.
+ */
+
+static dnode_t *
+dict_prev(tctree_t *dict, dnode_t *curr)
+{
+    dnode_t *nil = dict_nil(dict), *parent, *right;
+
+    if (curr->left != nil) {
+	curr = curr->left;
+	while ((right = curr->right) != nil)
+	    curr = right;
+	return curr;
+    }
+
+    parent = curr->parent;
+
+    while (parent != nil && curr == parent->left) {
+	curr = parent;
+	parent = curr->parent;
+    }
+
+    return (parent == nil) ? NULL : parent;
+}
+
+/*
+ * Return the node with the lowest or highest key in the tree, or a
+ * null pointer if the tree is empty.
+ */
+
+static dnode_t *
+dict_first(tctree_t *dict)
+{
+    dnode_t *nil = dict_nil(dict), *root = dict_root(dict), *left;
+
+    if (root != nil)
+	while ((left = root->left) != nil)
+	    root = left;
+
+    return (root == nil) ? NULL : root;
+}
+
+static dnode_t *
+dict_last(tctree_t *dict)
+{
+    dnode_t *nil = dict_nil(dict), *root = dict_root(dict), *right;
+
+    if (root != nil)
+	while ((right = root->right) != nil)
+	    root = right;
+
+    return (root == nil) ? NULL : root;
+}
+
+/*
+ * Locate the node with the smallest key greater than the given key,
+ * or greater than or equal to it if incl is nonzero.  A null pointer
+ * is returned if there is no such node.
+ */
+
+static dnode_t *
+do_ceil(tctree_t *dict, void *key, int incl)
+{
+    dnode_t *root = dict_root(dict);
+    dnode_t *nil = dict_nil(dict);
+    dnode_t *best = NULL;
+    int result;
+
+    while (root != nil) {
+	result = tct_compare(dict, key, root->key);
+	if (result < 0 || (result == 0 && incl)) {
+	    best = root;
+	    if (result == 0)
+		break;
+	    root = root->left;
+	} else {
+	    root = root->right;
+	}
+    }
+
+    return best;
+}
+
+/*
+ * Mirror image of do_ceil: locate the node with the largest key less
+ * than (or equal to) the given key.
+ */
+
+static dnode_t *
+do_floor(tctree_t *dict, void *key, int incl)
+{
+    dnode_t *root = dict_root(dict);
+    dnode_t *nil = dict_nil(dict);
+    dnode_t *best = NULL;
+    int result;
+
+    while (root != nil) {
+	result = tct_compare(dict, key, root->key);
+	if (result > 0 || (result == 0 && incl)) {
+	    best = root;
+	    if (result == 0)
+		break;
+	    root = root->right;
+	} else {
+	    root = root->left;
+	}
+    }
+
+    return best;
+}
+
+static int
+tree_bound(tctree_t *dict, void *key, void *r, int incl)
+{
+    void **ret = r;
+    void **k;
+
+    if(dict->flags & TCTREE_CONCURRENT)
+	return sltree_bound(dict, key, r, incl);
+
+    tree_lock(dict);
+
+    if(dict->flags & TCTREE_PERSISTENT){
+	k = ptree_ceil(dict, key, incl);
+    } else if(dict->flags & TCTREE_BTREE){
+	btnode_t *n;
+	int i;
+	k = btree_ceil(dict, key, incl, &n, &i);
+    } else {
+	dnode_t *node = do_ceil(dict, key, incl);
+	k = node? &node->key: NULL;
+    }
+
+    if(k && ret)
+	*ret = *k;
+
+    tree_unlock(dict);
+    return !k;
+}
+
+extern int
+tctree_lower_bound(tctree_t *t, void *key, void *ret)
+{
+    return tree_bound(t, key, ret, 1);
+}
+
+extern int
+tctree_upper_bound(tctree_t *t, void *key, void *ret)
+{
+    return tree_bound(t, key, ret, 0);
+}
+
+/*
+ * Store the keys of the subtree rooted at node in order.
+ */
+
+static void
+collect_keys(dnode_t *node, dnode_t *nil, void **keys, unsigned long *n)
+{
+    if (node == nil)
+	return;
+    collect_keys(node->left, nil, keys, n);
+    keys[(*n)++] = node->key;
+    collect_keys(node->right, nil, keys, n);
+}
+
+/*
+ * Build a perfectly balanced tree from the sorted keys in [lo, hi).
+ * Leaves are all on the last two levels.  Colouring the nodes on the
+ * last level red, when it is not full, gives every path the same
+ * number of black nodes.  Nodes are allocated in key order.
+ */
+
+static dnode_t *
+build_nodes(tctree_t *dict, void **keys, unsigned long lo, unsigned long hi,
+	    int depth, int redlevel)
+{
+    dnode_t *nil = dict_nil(dict), *node, *left;
+    unsigned long mid;
+
+    if (lo == hi)
+	return nil;
+
+    mid = lo + (hi - lo) / 2;
+
+    left = build_nodes(dict, keys, lo, mid, depth + 1, redlevel);
+
+    node = dnode_alloc(dict);
+    node->key = keys[mid];
+    node->color = (depth == redlevel) ? dnode_red : dnode_black;
+    node->count = hi - lo;
+    node->left = left;
+    if (left != nil)
+	left->parent = node;
+
+    node->right = build_nodes(dict, keys, mid + 1, hi, depth + 1, redlevel);
+    if (node->right != nil)
+	node->right->parent = node;
+
+    return node;
+}
+
+/*
+ * Merge the sorted arrays a and b into out, dropping keys from b that
+ * are already in a or earlier in b.  Returns the number of keys stored,
+ * or -1 if b is not sorted.
+ */
+
+static long
+merge_keys(tctree_t *dict, void **a, unsigned long na, void **b,
+	   unsigned long nb, void **out)
+{
+    unsigned long i = 0, j = 0, n = 0;
+    int result;
+
+    for (j = 1; j < nb; j++)
+	if (tct_compare(dict, b[j - 1], b[j]) > 0)
+	    return -1;
+
+    j = 0;
+    while (i < na || j < nb) {
+	if (j == nb) {
+	    out[n++] = a[i++];
+	    continue;
+	}
+	if (n && !tct_compare(dict, out[n - 1], b[j])) {
+	    j++;
+	    continue;
+	}
+	if (i == na) {
+	    out[n++] = b[j++];
+	    continue;
+	}
+	result = tct_compare(dict, a[i], b[j]);
+	if (result < 0) {
+	    out[n++] = a[i++];
+	} else if (result > 0) {
+	    out[n++] = b[j++];
+	} else {
+	    out[n++] = a[i++];
+	    j++;
+	}
+    }
+
+    return n;
+}
+
+extern long
+tctree_build_sorted(tctree_t *dict, void **keys, unsigned long n)
+{
+    unsigned long old = 0;
+    void **all, **cur = NULL;
+    long total;
+
+    if (dict->flags & TCTREE_CONCURRENT) {
+	unsigned long i;
+	total = 0;
+	for (i = 1; i < n; i++)
+	    if (tct_compare(dict, keys[i - 1], keys[i]) > 0)
+		return -1;
+	for (i = 0; i < n; i++)
+	    total += sltree_search(dict, keys[i], NULL, 0);
+	return total;
+    }
+
+    if (dict->flags & TCTREE_READONLY)
+	return -1;
+
+    tree_lock(dict);
+
+    if (dict->nodecount) {
+	cur = tcm_alloc(dict->nodecount * sizeof(*cur));
+	if (dict->flags & TCTREE_PERSISTENT)
+	    old = ptree_collect(dict, cur);
+	else if (dict->flags & TCTREE_BTREE)
+	    old = btree_collect(dict, cur);
+	else
+	    collect_keys(dict_root(dict), dict_nil(dict), cur, &old);
+    }
+
+    all = tcm_alloc((old + n) * sizeof(*all));
+    total = merge_keys(dict, cur, old, keys, n, all);
+    tcm_free(cur);
+
+    if (total < 0) {
+	tcm_free(all);
+	tree_unlock(dict);
+	return -1;
+    }
+
+    if (dict->flags & TCTREE_PERSISTENT) {
+	ptree_build(dict, all, total);
+    } else if (dict->flags & TCTREE_BTREE) {
+	btree_build(dict, all, total);
+    } else {
+	int redlevel = 0;
+	while ((2UL << redlevel) <= (unsigned long) total + 1)
+	    redlevel++;
+	if (dict->mp) {
+	    tcfree(dict->mp);
+	    dict->mp = tcmempool_new(sizeof(dnode_t), 0);
+	}
+	dict_root(dict) = build_nodes(dict, all, 0, total, 0, redlevel);
+	dict_root(dict)->parent = dict_nil(dict);
+	dict_root(dict)->color = dnode_black;
+    }
+
+    dict->nodecount = total;
+    dict->gen++;
+
+    tcm_free(all);
+    tree_unlock(dict);
+    return total - old;
+}
+
+extern long
+tctree_build_sorted_iter(tctree_t *t, tctree_next_fn next, void *data)
+{
+    unsigned long n = 0, size = 1024;
+    void **keys = tcm_alloc(size * sizeof(*keys));
+    long r;
+
+    while (!next(data, &keys[n])) {
+	if (++n == size)
+	    keys = tcm_realloc(keys, (size *= 2) * sizeof(*keys));
+    }
+
+    r = tctree_build_sorted(t, keys, n);
+    tcm_free(keys);
+    return r;
+}
+
+extern unsigned long
+tctree_items(tctree_t *t)
+{
+    return t->nodecount;
+}
+
+/*
+ * Find the k-th smallest key, counting from zero, using the subtree
+ * sizes kept by trees created with TCTREE_RANK.
+ */
+
+extern int
+tctree_select(tctree_t *dict, unsigned long k, void *r)
+{
+    dnode_t *node, *nil = dict_nil(dict);
+    void **ret = r;
+
+    if(!(dict->flags & TCTREE_RANK))
+	return -1;
+
+    tree_lock(dict);
+
+    node = dict_root(dict);
+    while (node != nil) {
+	unsigned long left = node->left->count;
+	if (k < left) {
+	    node = node->left;
+	} else if (k > left) {
+	    k -= left + 1;
+	    node = node->right;
+	} else {
+	    break;
+	}
+    }
+
+    if(node != nil && ret)
+	*ret = node->key;
+
+    tree_unlock(dict);
+    return node == nil;
+}
+
+/*
+ * Count the keys less than the given key.  The count is stored whether
+ * or not the key itself is in the tree.
+ */
+
+extern int
+tctree_rank(tctree_t *dict, void *key, unsigned long *rank)
+{
+    dnode_t *node, *nil = dict_nil(dict);
+    unsigned long r = 0;
+    int result;
+
+    if(!(dict->flags & TCTREE_RANK))
+	return -1;
+
+    tree_lock(dict);
+
+    node = dict_root(dict);
+    while (node != nil) {
+	result = tct_compare(dict, key, node->key);
+	if (result < 0) {
+	    node = node->left;
+	} else if (result > 0) {
+	    r += node->left->count + 1;
+	    node = node->right;
+	} else {
+	    r += node->left->count;
+	    break;
+	}
+    }
+
+    if(rank)
+	*rank = r;
+
+    tree_unlock(dict);
+    return node == nil;
+}
+
+extern tctree_cursor_t *
+tctree_range(tctree_t *t, void *low, void *high, uint32_t flags)
+{
+    tctree_cursor_t *c = tcm_zalloc(sizeof(*c));
+
+    c->tree = t;
+    c->low = low;
+    c->high = high;
+    c->flags = flags;
+    c->state = cursor_start;
+
+    return c;
+}
+
+/*
+ * Position a cursor on its first key, or on the key following the
+ * last one returned, and return a pointer to where the key is stored.
+ * If the tree has been modified since the cursor last moved, the
+ * saved position may be gone, so search for the next key from the top
+ * instead of stepping from it.
+ */
+
+static void **
+bt_cursor_step(tctree_cursor_t *c, void **np, int *ip)
+{
+    tctree_t *dict = c->tree;
+    btnode_t *n = c->node;
+    int i = c->idx;
+    void **k;
+
+    if(c->flags & TCTREE_REVERSE){
+	if(c->state == cursor_start){
+	    if(c->flags & TCTREE_NOHIGH)
+		k = btree_last(dict, &n, &i);
+	    else
+		k = btree_floor(dict, c->high, !(c->flags & TCTREE_EXCLHIGH),
+				&n, &i);
+	} else if(c->gen == dict->gen){
+	    k = btree_prev(&n, &i);
+	} else {
+	    k = btree_floor(dict, c->key, 0, &n, &i);
+	}
+    } else {
+	if(c->state == cursor_start){
+	    if(c->flags & TCTREE_NOLOW)
+		k = btree_first(dict, &n, &i);
+	    else
+		k = btree_ceil(dict, c->low, !(c->flags & TCTREE_EXCLLOW),
+			       &n, &i);
+	} else if(c->gen == dict->gen){
+	    k = btree_next(&n, &i);
+	} else {
+	    k = btree_ceil(dict, c->key, 0, &n, &i);
+	}
+    }
+
+    *np = n;
+    *ip = i;
+    return k;
+}
+
+/*
+ * Persistent tree nodes have no parent links, so every step searches
+ * from the root for the key after the last one returned.
+ */
+
+static void **
+pt_cursor_step(tctree_cursor_t *c)
+{
+    tctree_t *dict = c->tree;
+
+    if(c->flags & TCTREE_REVERSE){
+	if(c->state == cursor_start){
+	    if(c->flags & TCTREE_NOHIGH)
+		return ptree_last(dict);
+	    return ptree_floor(dict, c->high, !(c->flags & TCTREE_EXCLHIGH));
+	}
+	return ptree_floor(dict, c->key, 0);
+    }
+
+    if(c->state == cursor_start){
+	if(c->flags & TCTREE_NOLOW)
+	    return ptree_first(dict);
+	return ptree_ceil(dict, c->low, !(c->flags & TCTREE_EXCLLOW));
+    }
+    return ptree_ceil(dict, c->key, 0);
+}
+
+static dnode_t *
+rb_cursor_step(tctree_cursor_t *c)
+{
+    tctree_t *dict = c->tree;
+
+    if(c->flags & TCTREE_REVERSE){
+	if(c->state == cursor_start){
+	    if(c->flags & TCTREE_NOHIGH)
+		return dict_last(dict);
+	    return do_floor(dict, c->high, !(c->flags & TCTREE_EXCLHIGH));
+	}
+	if(c->gen == dict->gen)
+	    return dict_prev(dict, c->node);
+	return do_floor(dict, c->key, 0);
+    }
+
+    if(c->state == cursor_start){
+	if(c->flags & TCTREE_NOLOW)
+	    return dict_first(dict);
+	return do_ceil(dict, c->low, !(c->flags & TCTREE_EXCLLOW));
+    }
+    if(c->gen == dict->gen)
+	return dict_next(dict, c->node);
+    return do_ceil(dict, c->key, 0);
+}
+
+static void **
+cursor_step(tctree_cursor_t *c, void **np, int *ip)
+{
+    dnode_t *node;
+
+    if(c->tree->flags & TCTREE_CONCURRENT)
+	return sltree_cursor_step(c, np);
+    if(c->tree->flags & TCTREE_PERSISTENT){
+	*np = NULL;
+	return pt_cursor_step(c);
+    }
+    if(c->tree->flags & TCTREE_BTREE)
+	return bt_cursor_step(c, np, ip);
+
+    node = rb_cursor_step(c);
+    *np = node;
+    return node? &node->key: NULL;
+}
+
+static int
+cursor_inrange(tctree_cursor_t *c, void *key)
+{
+    tctree_t *dict = c->tree;
+    int result;
+
+    if(c->flags & TCTREE_REVERSE){
+	if(c->flags & TCTREE_NOLOW)
+	    return 1;
+	result = tct_compare(dict, key, c->low);
+	return result > 0 || (result == 0 && !(c->flags & TCTREE_EXCLLOW));
+    }
+
+    if(c->flags & TCTREE_NOHIGH)
+	return 1;
+    result = tct_compare(dict, key, c->high);
+    return result < 0 || (result == 0 && !(c->flags & TCTREE_EXCLHIGH));
+}
+
+extern int
+tctree_next(tctree_cursor_t *c, void *r)
+{
+    tctree_t *dict = c->tree;
+    void **ret = r;
+    void **k;
+    void *node;
+    int idx = 0;
+
+    if(c->state == cursor_done)
+	return 1;
+
+    if((dict->flags & TCTREE_CONCURRENT) && c->state == cursor_start)
+	c->epoch = sltree_enter(dict);
+
+    tree_lock(dict);
+
+    k = cursor_step(c, &node, &idx);
+    if(k && !cursor_inrange(c, *k))
+	k = NULL;
+
+    if(k){
+	c->node = node;
+	c->idx = idx;
+	c->key = *k;
+	c->gen = dict->gen;
+	c->state = cursor_active;
+	if(ret)
+	    *ret = *k;
+    } else {
+	c->state = cursor_done;
+	if(dict->flags & TCTREE_CONCURRENT)
+	    sltree_leave(dict, c->epoch);
+    }
+
+    tree_unlock(dict);
+    return !k;
+}
+
+extern void
+tctree_cursor_free(tctree_cursor_t *c)
+{
+    if((c->tree->flags & TCTREE_CONCURRENT) && c->state == cursor_active)
+	sltree_leave(c->tree, c->epoch);
+    tcm_free(c);
+}
+
 /*
  * Delete the given node from the dictionary. If the given node does not belong
  * to the given dictionary, undefined behavior results.  A pointer to the
@@ -367,8 +1128,25 @@ tctree_delete(tctree_t *dict, void *key, void *r)
     dnode_t *nil = dict_nil(dict), *child, *delparent, *delete;
     void **ret = r;
 
+    if(dict->flags & TCTREE_CONCURRENT)
+	return sltree_delete(dict, key, r);
+    if(dict->flags & TCTREE_READONLY)
+	return -1;
+
     tree_lock(dict);
 
+    if(dict->flags & TCTREE_PERSISTENT){
+	int r = ptree_delete(dict, key, ret);
+	tree_unlock(dict);
+	return r;
+    }
+
+    if(dict->flags & TCTREE_BTREE){
+	int r = btree_delete(dict, key, ret);
+	tree_unlock(dict);
+	return r;
+    }
+
     delete = do_find(dict, key);
     if(!delete){
 	tree_unlock(dict);
@@ -436,6 +1214,19 @@ tctree_delete(tctree_t *dict, void *key, void *r)
 	    delparent->right = next;
 	}
 
+	/*
+	 * Every node from the successor's old parent up to the root has
+	 * lost one descendant.  The successor itself takes over the size
+	 * of the deleted node, which is decremented along with the rest.
+	 */
+
+	if (dict->flags & TCTREE_RANK) {
+	    dnode_t *p = (nextparent == delete) ? next : nextparent;
+	    next->count = delete->count;
+	    for (; p != nil; p = p->parent)
+		p->count--;
+	}
+
     } else {
 	assert (delete != nil);
 	assert (delete->left == nil || delete->right == nil);
@@ -450,13 +1241,16 @@ tctree_delete(tctree_t *dict, void *key, void *r)
 	    assert (delete == delparent->right);
 	    delparent->right = child;
 	}
-    }
 
-    delete->parent = NULL;
-    delete->right = NULL;
-    delete->left = NULL;
+	if (dict->flags & TCTREE_RANK) {
+	    dnode_t *p;
+	    for (p = delparent; p != nil; p = p->parent)
+		p->count--;
+	}
+    }
 
     dict->nodecount--;
+    dict->gen++;
 
     /* red-black adjustments */
 
@@ -473,7 +1267,7 @@ tctree_delete(tctree_t *dict, void *key, void *r)
 		if (sister->color == dnode_red) {
 		    sister->color = dnode_black;
 		    parent->color = dnode_red;
-		    rotate_left(parent);
+		    rotate_left(dict, parent);
 		    sister = parent->right;
 		    assert (sister != nil);
 		}
@@ -486,14 +1280,14 @@ tctree_delete(tctree_t *dict, void *key, void *r)
 			assert (sister->left->color == dnode_red);
 			sister->left->color = dnode_black;
 			sister->color = dnode_red;
-			rotate_right(sister);
+			rotate_right(dict, sister);
 			sister = parent->right;
 			assert (sister != nil);
 		    }
 		    sister->color = parent->color;
 		    sister->right->color = dnode_black;
 		    parent->color = dnode_black;
-		    rotate_left(parent);
+		    rotate_left(dict, parent);
 		    break;
 		}
 	    } else {	/* symmetric case: child == child->parent->right */
@@ -503,7 +1297,7 @@ tctree_delete(tctree_t *dict, void *key, void *r)
 		if (sister->color == dnode_red) {
 		    sister->color = dnode_black;
 		    parent->color = dnode_red;
-		    rotate_right(parent);
+		    rotate_right(dict, parent);
 		    sister = parent->left;
 		    assert (sister != nil);
 		}
@@ -516,14 +1310,14 @@ tctree_delete(tctree_t *dict, void *key, void *r)
 			assert (sister->right->color == dnode_red);
 			sister->right->color = dnode_black;
 			sister->color = dnode_red;
-			rotate_left(sister);
+			rotate_left(dict, sister);
 			sister = parent->left;
 			assert (sister != nil);
 		    }
 		    sister->color = parent->color;
 		    sister->left->color = dnode_black;
 		    parent->color = dnode_black;
-		    rotate_right(parent);
+		    rotate_right(dict, parent);
 		    break;
 		}
 	    }
@@ -533,6 +1327,9 @@ tctree_delete(tctree_t *dict, void *key, void *r)
 	dict_root(dict)->color = dnode_black;
     }
 
+    if (dict->mp)
+	tcm_poolfree(delete);
+
     tree_unlock(dict);
     return 0;
 }
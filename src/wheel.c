@@ -0,0 +1,515 @@
+/**
+    Copyright (C) 2004  Michael Ahlberg, Måns Rullgård
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+**/
+
+/*
+ * Hierarchical timer wheel, after Varghese and Lauck.  The first level
+ * has one bucket per tick for the next 256 ticks.  Each further level
+ * has 64 buckets, each covering a whole turn of the level below.  When
+ * the first level wraps around, the next bucket of the level above is
+ * emptied into the levels below, and so on up.  Timers too far ahead
+ * for the top level wait in its last bucket and are sorted out again
+ * each time it comes round.
+ *
+ * Timers live in a table and are linked into buckets by index.  A
+ * handle is the index and a generation count, as for tcprioq.  Timers
+ * whose time has come are moved to a ready list, in order, from which
+ * they are returned.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <tcwheel.h>
+
+#define WHEEL_BITS0  8
+#define WHEEL_BITS   6
+#define WHEEL_LEVELS 6
+#define WHEEL_SIZE0  (1 << WHEEL_BITS0)
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_BUCKETS (WHEEL_SIZE0 + (WHEEL_LEVELS - 1) * WHEEL_SIZE)
+#define WHEEL_READY  WHEEL_BUCKETS
+#define WHEEL_MAXDELTA \
+    ((1ULL << (WHEEL_BITS0 + (WHEEL_LEVELS - 1) * WHEEL_BITS)) - 1)
+
+typedef struct wtimer {
+    void *data;
+    uint64_t expires;
+    int next, prev;
+    int bucket;
+    uint32_t gen;
+} wtimer_t;
+
+typedef struct wlist {
+    int head, tail;
+} wlist_t;
+
+struct tcwheel {
+    uint64_t cur;
+    wtimer_t *timers;
+    int ntimers;
+    int freetimer;
+    int count;
+    int pending;
+    wlist_t b[WHEEL_BUCKETS + 1];
+    uint64_t used[WHEEL_BUCKETS / 64];
+    int locking;
+    pthread_mutex_t lock;
+};
+
+static inline void
+tcw_lock(tcwheel_t *w)
+{
+    if(w->locking)
+	pthread_mutex_lock(&w->lock);
+}
+
+static inline void
+tcw_unlock(tcwheel_t *w)
+{
+    if(w->locking)
+	pthread_mutex_unlock(&w->lock);
+}
+
+static inline int
+level_shift(int l)
+{
+    return WHEEL_BITS0 + (l - 1) * WHEEL_BITS;
+}
+
+/* Buckets of upper levels, and their bitmaps, one word per level. */
+#define level_bucket(l, j) (WHEEL_SIZE0 + ((l) - 1) * WHEEL_SIZE + (j))
+#define level_used(w, l) ((w)->used[WHEEL_SIZE0 / 64 + (l) - 1])
+
+static inline void
+mark_used(tcwheel_t *w, int b)
+{
+    if(b < WHEEL_BUCKETS)
+	w->used[b / 64] |= 1ULL << (b % 64);
+}
+
+static inline void
+mark_empty(tcwheel_t *w, int b)
+{
+    if(b < WHEEL_BUCKETS)
+	w->used[b / 64] &= ~(1ULL << (b % 64));
+}
+
+static void
+list_append(tcwheel_t *w, int b, int t)
+{
+    wtimer_t *tm = &w->timers[t];
+
+    tm->bucket = b;
+    tm->next = -1;
+    tm->prev = w->b[b].tail;
+    if(tm->prev < 0)
+	w->b[b].head = t;
+    else
+	w->timers[tm->prev].next = t;
+    w->b[b].tail = t;
+
+    mark_used(w, b);
+}
+
+static void
+list_unlink(tcwheel_t *w, int t)
+{
+    wtimer_t *tm = &w->timers[t];
+    int b = tm->bucket;
+
+    if(tm->prev < 0)
+	w->b[b].head = tm->next;
+    else
+	w->timers[tm->prev].next = tm->next;
+    if(tm->next < 0)
+	w->b[b].tail = tm->prev;
+    else
+	w->timers[tm->next].prev = tm->prev;
+
+    if(w->b[b].head < 0)
+	mark_empty(w, b);
+}
+
+/*
+ * Move a whole bucket to the end of another list.
+ */
+
+static void
+list_splice(tcwheel_t *w, int from, int to)
+{
+    int t, h = w->b[from].head;
+
+    if(h < 0)
+	return;
+
+    for(t = h; t >= 0; t = w->timers[t].next)
+	w->timers[t].bucket = to;
+
+    w->timers[h].prev = w->b[to].tail;
+    if(w->b[to].tail < 0)
+	w->b[to].head = h;
+    else
+	w->timers[w->b[to].tail].next = h;
+    w->b[to].tail = w->b[from].tail;
+
+    w->b[from].head = w->b[from].tail = -1;
+    mark_empty(w, from);
+    mark_used(w, to);
+}
+
+/*
+ * Put a timer in the bucket for its expiry time, or on the ready list
+ * if that has passed.
+ */
+
+static void
+place(tcwheel_t *w, int t)
+{
+    uint64_t e = w->timers[t].expires, delta;
+    int l;
+
+    if(e < w->cur){
+	list_append(w, WHEEL_READY, t);
+	w->pending++;
+	return;
+    }
+
+    delta = e - w->cur;
+    if(delta < WHEEL_SIZE0){
+	list_append(w, e & (WHEEL_SIZE0 - 1), t);
+	return;
+    }
+
+    if(delta > WHEEL_MAXDELTA)
+	e = w->cur + WHEEL_MAXDELTA;
+
+    for(l = 1; l < WHEEL_LEVELS - 1; l++)
+	if(delta < 1ULL << level_shift(l + 1))
+	    break;
+
+    list_append(w, level_bucket(l, (e >> level_shift(l)) & (WHEEL_SIZE - 1)),
+		t);
+}
+
+static void
+cascade(tcwheel_t *w)
+{
+    int l, t, n;
+
+    for(l = 1; l < WHEEL_LEVELS; l++){
+	int j = (w->cur >> level_shift(l)) & (WHEEL_SIZE - 1);
+	int b = level_bucket(l, j);
+
+	t = w->b[b].head;
+	w->b[b].head = w->b[b].tail = -1;
+	mark_empty(w, b);
+	for(; t >= 0; t = n){
+	    n = w->timers[t].next;
+	    place(w, t);
+	}
+
+	if(j)
+	    break;
+    }
+}
+
+/*
+ * Index of the first used first-level bucket from i on, or WHEEL_SIZE0.
+ */
+
+static int
+next_used(tcwheel_t *w, int i)
+{
+    while(i < WHEEL_SIZE0){
+	uint64_t m = w->used[i / 64] >> (i % 64);
+	if(m)
+	    return i + __builtin_ctzll(m);
+	i = (i / 64 + 1) * 64;
+    }
+
+    return WHEEL_SIZE0;
+}
+
+/*
+ * With the first level empty, find the next time from t, which starts
+ * a turn of the first level, when an upper level bucket needs to be
+ * emptied.  Levels that are empty are skipped entirely.
+ */
+
+static uint64_t
+next_cascade(tcwheel_t *w, uint64_t t)
+{
+    int l;
+
+    for(l = 1; l < WHEEL_LEVELS; l++){
+	int sh = level_shift(l);
+	uint64_t m = level_used(w, l);
+	int i = (t >> sh) & (WHEEL_SIZE - 1);
+
+	if(!m)
+	    continue;
+
+	/* the level above is emptied first */
+	if(!(t & ((1ULL << (sh + WHEEL_BITS)) - 1)))
+	    return t;
+
+	if(t & ((1ULL << sh) - 1))
+	    i++;
+	if(i < WHEEL_SIZE && (m >> i))
+	    return ((t >> sh) - ((t >> sh) & (WHEEL_SIZE - 1)) + i +
+		    __builtin_ctzll(m >> i)) << sh;
+
+	return ((t >> (sh + WHEEL_BITS)) + 1) << (sh + WHEEL_BITS);
+    }
+
+    return ~0ULL;
+}
+
+static int
+level0_empty(tcwheel_t *w)
+{
+    int i;
+
+    for(i = 0; i < WHEEL_SIZE0 / 64; i++)
+	if(w->used[i])
+	    return 0;
+
+    return 1;
+}
+
+/*
+ * Process all ticks up to now, skipping over empty buckets.
+ */
+
+static void
+advance(tcwheel_t *w, uint64_t now)
+{
+    while(w->cur <= now){
+	int i = w->cur & (WHEEL_SIZE0 - 1), n;
+
+	if(w->count == w->pending){
+	    w->cur = now + 1;
+	    break;
+	}
+
+	if(!i)
+	    cascade(w);
+
+	if(w->b[i].head >= 0){
+	    int t;
+	    for(t = w->b[i].head; t >= 0; t = w->timers[t].next)
+		w->pending++;
+	    list_splice(w, i, WHEEL_READY);
+	}
+
+	n = next_used(w, i + 1);
+	w->cur = (w->cur & ~(uint64_t) (WHEEL_SIZE0 - 1)) + n;
+	if(n == WHEEL_SIZE0 && level0_empty(w))
+	    w->cur = next_cascade(w, w->cur);
+	if(w->cur > now + 1)
+	    w->cur = now + 1;
+    }
+}
+
+static int
+timer_alloc(tcwheel_t *w)
+{
+    int t, n;
+
+    if(w->freetimer < 0){
+	wtimer_t *tm;
+	n = w->ntimers? w->ntimers * 2: 64;
+	tm = realloc(w->timers, n * sizeof(*tm));
+	if(!tm)
+	    return -1;
+	for(t = w->ntimers; t < n; t++){
+	    tm[t].next = t + 1 < n? t + 1: -1;
+	    tm[t].bucket = -1;
+	    tm[t].gen = 1;
+	}
+	w->freetimer = w->ntimers;
+	w->timers = tm;
+	w->ntimers = n;
+    }
+
+    t = w->freetimer;
+    w->freetimer = w->timers[t].next;
+    return t;
+}
+
+static void
+timer_free(tcwheel_t *w, int t)
+{
+    w->timers[t].gen++;
+    w->timers[t].bucket = -1;
+    w->timers[t].next = w->freetimer;
+    w->freetimer = t;
+}
+
+static int
+timer_get(tcwheel_t *w, tcwheel_handle_t h)
+{
+    uint32_t t = h & 0xffffffff;
+
+    if(t >= (uint32_t) w->ntimers || w->timers[t].gen != h >> 32 ||
+       w->timers[t].bucket < 0)
+	return -1;
+
+    return t;
+}
+
+/*
+ * Take a timer out of the wheel, or off the ready list.
+ */
+
+static void
+timer_remove(tcwheel_t *w, int t)
+{
+    if(w->timers[t].bucket == WHEEL_READY)
+	w->pending--;
+    list_unlink(w, t);
+}
+
+extern tcwheel_t *
+tcwheel_new(int lock, uint64_t now)
+{
+    tcwheel_t *w = calloc(1, sizeof(*w));
+    int i;
+
+    w->cur = now + 1;
+    w->freetimer = -1;
+    for(i = 0; i <= WHEEL_BUCKETS; i++)
+	w->b[i].head = w->b[i].tail = -1;
+    w->locking = lock;
+    if(lock)
+	pthread_mutex_init(&w->lock, NULL);
+
+    return w;
+}
+
+extern int
+tcwheel_add(tcwheel_t *w, void *data, uint64_t expires, tcwheel_handle_t *h)
+{
+    int t;
+
+    tcw_lock(w);
+
+    t = timer_alloc(w);
+    if(t < 0){
+	tcw_unlock(w);
+	return -1;
+    }
+
+    w->timers[t].data = data;
+    w->timers[t].expires = expires;
+    place(w, t);
+    w->count++;
+    if(h)
+	*h = (uint64_t) w->timers[t].gen << 32 | t;
+
+    tcw_unlock(w);
+    return 0;
+}
+
+extern int
+tcwheel_update(tcwheel_t *w, tcwheel_handle_t h, uint64_t expires)
+{
+    int t, rt = 1;
+
+    tcw_lock(w);
+
+    if((t = timer_get(w, h)) >= 0){
+	timer_remove(w, t);
+	w->timers[t].expires = expires;
+	place(w, t);
+	rt = 0;
+    }
+
+    tcw_unlock(w);
+    return rt;
+}
+
+extern int
+tcwheel_cancel(tcwheel_t *w, tcwheel_handle_t h, void **ret)
+{
+    int t, rt = 1;
+
+    tcw_lock(w);
+
+    if((t = timer_get(w, h)) >= 0){
+	timer_remove(w, t);
+	if(ret)
+	    *ret = w->timers[t].data;
+	timer_free(w, t);
+	w->count--;
+	rt = 0;
+    }
+
+    tcw_unlock(w);
+    return rt;
+}
+
+extern int
+tcwheel_get_many(tcwheel_t *w, uint64_t now, void **ret, int n)
+{
+    int i;
+
+    tcw_lock(w);
+
+    if(now >= w->cur)
+	advance(w, now);
+
+    for(i = 0; i < n && w->pending; i++){
+	int t = w->b[WHEEL_READY].head;
+	if(w->timers[t].expires > now)
+	    break;
+	ret[i] = w->timers[t].data;
+	timer_remove(w, t);
+	timer_free(w, t);
+	w->count--;
+    }
+
+    tcw_unlock(w);
+    return i;
+}
+
+extern int
+tcwheel_get(tcwheel_t *w, uint64_t now, void **ret)
+{
+    return tcwheel_get_many(w, now, ret, 1)? 0: -1;
+}
+
+extern int
+tcwheel_items(tcwheel_t *w)
+{
+    return w->count;
+}
+
+extern void
+tcwheel_free(tcwheel_t *w)
+{
+    free(w->timers);
+    if(w->locking)
+	pthread_mutex_destroy(&w->lock);
+    free(w);
+}